@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Scheduler context of the benchmarks
+ *  What sim.c sets up before add_proc, get_proc, put_proc and finish_proc
+ *  can be called, for one CPU and no timer. Any new requirement of those
+ *  goes here, so every benchmark picks it up.
+ */
+
+#include "sched.h"
+#include "sim.h"
+#include <stdlib.h>
+#include <string.h>
+
+static struct sim_ctx *bench_ctx_new(int policy) {
+  struct sim_ctx *ctx = aligned_alloc(CACHE_LINE_SIZE, sizeof(*ctx));
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->max_cpus = 1;
+  ctx->time_slot = 2;
+  ctx->policy = policy;
+  ctx->cfs_latency = CFS_TARGET_LATENCY;
+  ctx->cfs_min_gran = CFS_MIN_GRANULARITY;
+  group_lookup(ctx, GROUP_DEFAULT);
+  pthread_mutex_init(&ctx->stats_lock, NULL);
+  ctx->cpus = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct cpu_args));
+  memset(ctx->cpus, 0, sizeof(struct cpu_args));
+  init_scheduler(ctx);
+  return ctx;
+}
+
+static void bench_ctx_free(struct sim_ctx *ctx) {
+  finish_scheduler(ctx);
+  group_destroy(ctx);
+  pthread_mutex_destroy(&ctx->stats_lock);
+  free(ctx->finished);
+  free(ctx->cpus);
+  free(ctx);
+}
+
+#endif
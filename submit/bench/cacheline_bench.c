@@ -0,0 +1,157 @@
+/*
+ * Per-CPU state layout benchmark
+ *  Run N devices on the slot barrier; in every slot each device updates
+ *  the hot fields of its own per-CPU record (what cpu_step does to its
+ *  cpu_args) a number of times. The records are laid out once packed back
+ *  to back, as the simulator used to, and once padded to a cache line each.
+ *  Report slots per second and, when the host lets us read hardware
+ *  counters, cache misses per slot for both layouts.
+ *
+ *  Usage: bench_cacheline [slots] [updates per slot]
+ */
+
+#include "timer.h"
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Hot fields of cpu_args, without and with the padding */
+struct packed_cpu {
+  int time_left;
+  uint64_t last_slot;
+  uint64_t idle_slots;
+};
+
+struct padded_cpu {
+  int time_left;
+  uint64_t last_slot;
+  uint64_t idle_slots;
+} CACHELINE_ALIGNED;
+
+static int nslots = 20000;
+static int nupdates = 64;
+
+struct dev {
+  struct timer_id_t *timer_id;
+  int *time_left;
+  uint64_t *last_slot;
+  uint64_t *idle_slots;
+};
+
+static void *dev_routine(void *args) {
+  struct dev *d = (struct dev *)args;
+  int i, j;
+  for (i = 0; i < nslots; i++) {
+    for (j = 0; j < nupdates; j++) {
+      __atomic_store_n(d->time_left, *d->time_left - 1, __ATOMIC_RELAXED);
+      __atomic_store_n(d->last_slot, i, __ATOMIC_RELAXED);
+      __atomic_store_n(d->idle_slots, *d->idle_slots + 1, __ATOMIC_RELAXED);
+    }
+    next_slot(d->timer_id);
+  }
+  detach_event(d->timer_id);
+  return NULL;
+}
+
+/* Cache miss counter of this process and the threads it creates from now
+ * on, -1 if the host has no (accessible) hardware counters */
+static int open_misses(void) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run [ncpus] devices whose records are [stride] bytes apart in [base] */
+static void run(FILE *devnull, const char *layout, int ncpus, char *base,
+                size_t stride) {
+  pthread_t *threads = malloc(ncpus * sizeof(pthread_t));
+  struct dev *devs = malloc(ncpus * sizeof(struct dev));
+  struct timer_struct timer;
+  int i;
+
+  init_timer(&timer, devnull);
+  for (i = 0; i < ncpus; i++) {
+    /* Both record types have the same field offsets */
+    struct packed_cpu *rec = (struct packed_cpu *)(base + i * stride);
+    memset(rec, 0, sizeof(*rec));
+    devs[i].timer_id = attach_event(&timer);
+    devs[i].time_left = &rec->time_left;
+    devs[i].last_slot = &rec->last_slot;
+    devs[i].idle_slots = &rec->idle_slots;
+  }
+  start_timer(&timer);
+
+  int fd = open_misses();
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  double start = now_sec();
+  for (i = 0; i < ncpus; i++)
+    pthread_create(&threads[i], NULL, dev_routine, &devs[i]);
+  for (i = 0; i < ncpus; i++)
+    pthread_join(threads[i], NULL);
+  double elapsed = now_sec() - start;
+
+  char misses[32] = "n/a";
+  uint64_t count;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) == sizeof(count))
+      snprintf(misses, sizeof(misses), "%.1f", (double)count / nslots);
+    close(fd);
+  }
+
+  stop_timer(&timer);
+  fprintf(stderr, "%8d %8s %14.0f %16s\n", ncpus, layout, nslots / elapsed,
+          misses);
+  free(devs);
+  free(threads);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1)
+    nslots = atoi(argv[1]);
+  if (argc > 2)
+    nupdates = atoi(argv[2]);
+  FILE *devnull = fopen("/dev/null", "w");
+  if (devnull == NULL)
+    return 1;
+
+  fprintf(stderr, "%8s %8s %14s %16s\n", "cpus", "layout", "slots/sec",
+          "misses/slot");
+  int sizes[] = {16, 64};
+  int k;
+  for (k = 0; k < 2; k++) {
+    int ncpus = sizes[k];
+    char *packed = malloc(ncpus * sizeof(struct packed_cpu));
+    char *padded = aligned_alloc(CACHE_LINE_SIZE,
+                                 ncpus * sizeof(struct padded_cpu));
+    run(devnull, "packed", ncpus, packed, sizeof(struct packed_cpu));
+    run(devnull, "padded", ncpus, padded, sizeof(struct padded_cpu));
+    free(padded);
+    free(packed);
+  }
+  fclose(devnull);
+  return 0;
+}
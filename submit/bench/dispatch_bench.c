@@ -0,0 +1,100 @@
+/*
+ * Dispatch benchmark
+ *  Put one process on each of N priority levels (the lowest N, so a scan
+ *  from priority 0 has the longest way to go) and time a get_proc /
+ *  put_proc round trip through the scheduler. For reference it also times
+ *  the linear scan over all MAX_PRIO queues that get_proc used to do to
+ *  find the same priority. Then it times the same round trip under every
+ *  policy, with one process on each priority.
+ *
+ *  Usage: bench_dispatch [rounds]
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long rounds = 2000000;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The lookup of the old get_mlq_proc */
+static int scan_prio(struct cpu_rq *rq) {
+  int prio;
+  for (prio = 0; prio < MAX_PRIO; prio++) {
+    if (!empty(&rq->mlq_ready_queue[prio]) &&
+        rq->mlq_ready_queue[prio].cpuRemainder > 0)
+      return prio;
+  }
+  return MAX_PRIO;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1)
+    rounds = atol(argv[1]);
+
+  fprintf(stderr, "%8s %16s %16s\n", "levels", "scan ns", "get+put ns");
+  int levels;
+  for (levels = 1; levels <= MAX_PRIO; levels = levels < 128 ? 2 * levels
+                                                              : MAX_PRIO) {
+    struct sim_ctx *ctx = bench_ctx_new(POLICY_MLQ);
+    struct pcb_t *procs = calloc(levels, sizeof(struct pcb_t));
+    int i;
+    for (i = 0; i < levels; i++) {
+      procs[i].prio = MAX_PRIO - levels + i;
+      add_proc(ctx, &procs[i]);
+    }
+
+    volatile int sink = 0;
+    long r;
+    double start = now_sec();
+    for (r = 0; r < rounds; r++)
+      sink += scan_prio(&ctx->sched.rq[0]);
+    double scan = now_sec() - start;
+
+    start = now_sec();
+    for (r = 0; r < rounds; r++)
+      put_proc(ctx, 0, get_proc(ctx, 0));
+    double dispatch = now_sec() - start;
+
+    fprintf(stderr, "%8d %16.1f %16.1f\n", levels, scan * 1e9 / rounds,
+            dispatch * 1e9 / rounds);
+    bench_ctx_free(ctx);
+    free(procs);
+    if (levels == MAX_PRIO)
+      break;
+  }
+
+  fprintf(stderr, "\n%8s %16s\n", "policy", "get+put ns");
+  int policy;
+  for (policy = 0; policy < NUM_POLICIES; policy++) {
+    struct sim_ctx *ctx = bench_ctx_new(policy);
+    struct pcb_t *procs = calloc(MAX_PRIO, sizeof(struct pcb_t));
+    int i;
+    for (i = 0; i < MAX_PRIO; i++) {
+      procs[i].prio = i;
+      add_proc(ctx, &procs[i]);
+    }
+
+    long r;
+    double start = now_sec();
+    for (r = 0; r < rounds; r++) {
+      struct pcb_t *proc = get_proc(ctx, 0);
+      sched_slice(ctx, 0, proc);
+      put_proc(ctx, 0, proc);
+    }
+    double dispatch = now_sec() - start;
+
+    fprintf(stderr, "%8s %16.1f\n", sched_classes[policy]->name,
+            dispatch * 1e9 / rounds);
+    bench_ctx_free(ctx);
+    free(procs);
+  }
+  return 0;
+}
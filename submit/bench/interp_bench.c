@@ -0,0 +1,193 @@
+/*
+ * Interpreter benchmark
+ *  Run a code segment of calc runs of length L, each ended by an io (which
+ *  only hands the process back to its CPU), and report instructions per
+ *  second three ways:
+ *   text:   the fetch and dispatch run() used to do, a copy of the
+ *           instruction from the text then a switch on its opcode
+ *   run:    run() on the decoded segment, a jump through the handler
+ *   fused:  what a CPU does, run() for the first calc of a run then the
+ *           slot fast path of cpu_step for the others, up to a slice
+ *
+ *  Usage: bench_interp [instructions]
+ */
+
+#include "cpu.h"
+#include "mm.h"
+#include "sim.h"
+#include "sync.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long ninsts = 50000000;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The calc instruction (cpu.c) */
+int calc(struct pcb_t *proc);
+
+/* run() as it was before the decoded form, a copy of the instruction
+ * then a switch on its opcode, the same handlers inlined */
+static __attribute__((noinline)) int text_run(struct pcb_t *proc) {
+  if (proc->pc >= proc->end) {
+    return 1;
+  }
+
+  struct inst_t ins = proc->code->text[proc->pc];
+  proc->pc++;
+  int stat = 1;
+  switch (ins.opcode) {
+  case CALC:
+    stat = calc(proc);
+    break;
+  case ALLOC:
+    fprintf(proc->ctx->out, "*=======================\n");
+    stat = pgalloc(proc, ins.arg_0, ins.arg_1);
+    fprintf(proc->ctx->out, "process %d alloc region %d size %d\n\n",
+            proc->pid, ins.arg_1, ins.arg_0);
+    print_pgtbl(proc, 0, -1);
+    fprintf(proc->ctx->out, "=======================*\n");
+    MEMPHY_dump(proc->mram, proc->ctx->out);
+    break;
+  case FREE:
+    fprintf(proc->ctx->out, "*=======================\n");
+    stat = pgfree_data(proc, ins.arg_0);
+    fprintf(proc->ctx->out, "process %d free region %d\n\n", proc->pid,
+            ins.arg_0);
+    fprintf(proc->ctx->out, "=======================*\n");
+    break;
+  case READ:
+    fprintf(proc->ctx->out, "*=======================\n");
+    stat = pgread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+    fprintf(proc->ctx->out, "=======================*\n");
+    break;
+  case WRITE:
+    fprintf(proc->ctx->out, "*=======================\n");
+    stat = pgwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+    fprintf(proc->ctx->out, "=======================*\n");
+    break;
+  case COPY:
+    fprintf(proc->ctx->out, "*=======================\n");
+    stat = pgcopy(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3, ins.arg_4);
+    fprintf(proc->ctx->out, "=======================*\n");
+    break;
+  case FILL:
+    fprintf(proc->ctx->out, "*=======================\n");
+    stat = pgfill(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
+    fprintf(proc->ctx->out, "=======================*\n");
+    break;
+  case LOCK:
+  case UNLOCK:
+  case WAIT:
+  case SIGNAL:
+    stat = sync_run(proc, ins.opcode, ins.arg_0);
+    break;
+  case IO:
+    stat = RUN_BLOCKED;
+    break;
+  case SPAWN:
+    stat = thread_spawn(proc, ins.arg_0);
+    break;
+  case JOIN:
+    stat = thread_join(proc);
+    break;
+  default:
+    stat = 1;
+  }
+  return stat;
+}
+
+/* The calc fast path at the top of cpu_step */
+static __attribute__((noinline)) int fast_step(struct cpu_args *cpu) {
+  if (cpu->calc_left > 0 &&
+      !__atomic_load_n(&cpu->need_resched, __ATOMIC_ACQUIRE)) {
+    cpu->proc->pc++;
+    cpu->calc_left--;
+    cpu->time_left--;
+    cpu->busy_slots++;
+    return 1;
+  }
+  return 0;
+}
+
+static struct code_seg_t *new_code(uint32_t size, uint32_t len) {
+  struct code_seg_t *code = malloc(sizeof(*code));
+  code->size = size;
+  code->text = calloc(size, sizeof(struct inst_t));
+  code->ops = NULL;
+  uint32_t i;
+  for (i = 0; i < size; i++)
+    code->text[i].opcode = (i + 1) % (len + 1) == 0 ? IO : CALC;
+  cpu_decode(code);
+  return code;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1)
+    ninsts = atol(argv[1]);
+
+  const uint32_t size = 4096;
+  const int slice = 20;
+  fprintf(stderr, "%8s %14s %14s %14s\n", "calc run", "text/sec",
+          "run/sec", "fused/sec");
+  uint32_t len;
+  for (len = 1; len <= 256; len *= 4) {
+    struct code_seg_t *code = new_code(size, len);
+    struct pcb_t proc;
+    memset(&proc, 0, sizeof(proc));
+    proc.code = code;
+    proc.end = size;
+    long rounds = ninsts / size, r;
+
+    double start = now_sec();
+    for (r = 0; r < rounds; r++) {
+      proc.pc = 0;
+      while (proc.pc < proc.end)
+        text_run(&proc);
+    }
+    double t_text = now_sec() - start;
+
+    start = now_sec();
+    for (r = 0; r < rounds; r++) {
+      proc.pc = 0;
+      while (proc.pc < proc.end)
+        run(&proc);
+    }
+    double t_run = now_sec() - start;
+
+    struct cpu_args cpu;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.proc = &proc;
+    start = now_sec();
+    for (r = 0; r < rounds; r++) {
+      proc.pc = 0;
+      while (proc.pc < proc.end) {
+        if (fast_step(&cpu))
+          continue;
+        if (cpu.time_left == 0)
+          cpu.time_left = slice;
+        run(&proc);
+        int calcs = calc_run(&proc);
+        cpu.calc_left =
+            calcs < cpu.time_left - 1 ? calcs : cpu.time_left - 1;
+        cpu.time_left--;
+      }
+    }
+    double t_fused = now_sec() - start;
+
+    double n = (double)rounds * size;
+    fprintf(stderr, "%8u %14.0f %14.0f %14.0f\n", len, n / t_text,
+            n / t_run, n / t_fused);
+    free(code->ops);
+    free(code->text);
+    free(code);
+  }
+  return 0;
+}
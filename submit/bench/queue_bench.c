@@ -0,0 +1,75 @@
+/*
+ * Ready queue scaling benchmark
+ *  Add N processes to the MLQ scheduler, spread over every priority (or
+ *  all on one), then dispatch each of them twice: the first time it is put
+ *  back, the second time it finishes. Report the time per scheduler call
+ *  and exit with 1 as soon as a process is lost or the queues are not
+ *  empty at the end (make check runs it).
+ *
+ *  Usage: bench_queue [max processes]
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Exit with 1 unless all [nprocs] processes went through */
+static void run(int nprocs, int nprios) {
+  struct sim_ctx *ctx = bench_ctx_new(POLICY_MLQ);
+
+  double start = now_sec();
+  int i;
+  for (i = 0; i < nprocs; i++) {
+    struct pcb_t *proc = calloc(1, sizeof(struct pcb_t));
+    proc->pid = i + 1;
+    proc->prio = MAX_PRIO - 1 - i % nprios;
+    add_proc(ctx, proc);
+  }
+  int finished = 0;
+  struct pcb_t *proc;
+  while ((proc = get_proc(ctx, 0)) != NULL) {
+    if (proc->pc++ == 0) {
+      put_proc(ctx, 0, proc);
+    } else {
+      finish_proc(ctx, 0, &proc);
+      finished++;
+    }
+  }
+  double elapsed = now_sec() - start;
+
+  int lost = nprocs - finished;
+  if (queue_empty(ctx) != 1)
+    lost = lost ? lost : -1;
+  /* add, two gets, put, finish */
+  fprintf(stderr, "%10d %8d %12.3f %14.1f %8d\n", nprocs, nprios, elapsed,
+          elapsed * 1e9 / (5.0 * nprocs), lost);
+  bench_ctx_free(ctx);
+  if (lost != 0) {
+    fprintf(stderr, "bench_queue: %d processes on %d priorities, lost %d\n",
+            nprocs, nprios, lost);
+    exit(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int max_procs = 100000;
+  if (argc > 1)
+    max_procs = atoi(argv[1]);
+
+  fprintf(stderr, "%10s %8s %12s %14s %8s\n", "processes", "prios", "sec",
+          "ns/call", "lost");
+  int n;
+  for (n = 1000; n <= max_procs; n *= 10) {
+    run(n, MAX_PRIO);
+    run(n, 1);
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Slot barrier benchmark
+ *  Attach N devices to the timer, let every device run a fixed number of
+ *  empty slots and report how many slots per second the barrier sustains.
+ *  The per-slot "Time slot" trace of the timer is sent to /dev/null.
+ *
+ *  Usage: bench_timer [slots]
+ */
+
+#include "timer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static int nslots = 20000;
+
+static void *dev_routine(void *args) {
+  struct timer_id_t *timer_id = (struct timer_id_t *)args;
+  int i;
+  for (i = 0; i < nslots; i++)
+    next_slot(timer_id);
+  detach_event(timer_id);
+  return NULL;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1)
+    nslots = atoi(argv[1]);
+  FILE *devnull = fopen("/dev/null", "w");
+  if (devnull == NULL)
+    return 1;
+
+  fprintf(stderr, "%8s %14s\n", "cpus", "slots/sec");
+  int ncpus;
+  for (ncpus = 1; ncpus <= 256; ncpus *= 2) {
+    pthread_t *dev = malloc(ncpus * sizeof(pthread_t));
+    struct timer_struct timer;
+    struct timer_id_t **ids = malloc(ncpus * sizeof(struct timer_id_t *));
+    int i;
+    init_timer(&timer, devnull);
+    for (i = 0; i < ncpus; i++)
+      ids[i] = attach_event(&timer);
+    start_timer(&timer);
+
+    double start = now_sec();
+    for (i = 0; i < ncpus; i++)
+      pthread_create(&dev[i], NULL, dev_routine, ids[i]);
+    for (i = 0; i < ncpus; i++)
+      pthread_join(dev[i], NULL);
+    double elapsed = now_sec() - start;
+
+    stop_timer(&timer);
+    fprintf(stderr, "%8d %14.0f\n", ncpus, nslots / elapsed);
+    free(ids);
+    free(dev);
+  }
+  fclose(devnull);
+  return 0;
+}
@@ -1,3 +1,6 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
 #ifdef CONFIG_64BIT
 #define BITS_PER_LONG 64
 #else
@@ -35,3 +38,40 @@
 #define NBITS(n) (n==0?0:NBITS32(n))
 
 #define EXTRACT_NBITS(nr, h, l) ((nr&GENMASK(h,l)) >> l)
+
+/*
+ * Bitmaps of unsigned long words, bit nr of the map is bit nr % word of
+ * word nr / word (BITS_PER_LONG is not the host word size, so these go
+ * by sizeof(unsigned long)).
+ */
+#define BITMAP_WORD_BITS	(BITS_PER_BYTE * sizeof(unsigned long))
+
+static inline void set_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITMAP_WORD_BITS] |= 1UL << (nr % BITMAP_WORD_BITS);
+}
+
+static inline void clear_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITMAP_WORD_BITS] &= ~(1UL << (nr % BITMAP_WORD_BITS));
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[nr / BITMAP_WORD_BITS] >> (nr % BITMAP_WORD_BITS)) & 1;
+}
+
+/* Index of the lowest set bit among the first [size], or [size] if none */
+static inline int find_first_bit(const unsigned long *addr, int size)
+{
+	int i;
+	for (i = 0; i * (int)BITMAP_WORD_BITS < size; i++) {
+		if (addr[i]) {
+			int nr = i * BITMAP_WORD_BITS + __builtin_ctzl(addr[i]);
+			return nr < size ? nr : size;
+		}
+	}
+	return size;
+}
+
+#endif /* BITOPS_H */
@@ -0,0 +1,32 @@
+#ifndef CKPT_H
+#define CKPT_H
+
+#include <stdio.h>
+
+struct sim_ctx;
+
+/*
+ * Checkpoint of a whole simulation, taken between two time slots.
+ *
+ * The snapshot file is a table of objects (every heap block reachable from
+ * the sim_ctx: PCBs, code, mm_struct and its lists, frame lists, the
+ * loader's process list), a relocation table listing every pointer field
+ * of those objects, and the raw object bytes. MEMPHY storage is kept page
+ * aligned so restore maps it straight from the file (copy-on-write); the
+ * small objects are copied to the heap and their pointers relocated.
+ */
+
+/* Write the state of [ctx] to [path], return 0 on success */
+int ckpt_save(struct sim_ctx *ctx, const char *path);
+
+/* Rebuild a simulation from the snapshot at [path], in place of sim_init.
+ * Return 0 on success, -1 if the file is not a snapshot of this build */
+int ckpt_restore(struct sim_ctx *ctx, const char *path, FILE *out);
+
+/* Whether [ptr] lives in the snapshot mapped by ckpt_restore */
+int ckpt_mapped(struct sim_ctx *ctx, const void *ptr);
+
+/* Drop the snapshot mapping, once nothing points into it any more */
+void ckpt_unmap(struct sim_ctx *ctx);
+
+#endif
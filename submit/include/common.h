@@ -5,6 +5,8 @@
 
 #include <stdint.h>
 
+struct sim_ctx;
+
 #ifndef OSCFG_H
 #include "os-cfg.h"
 #endif
@@ -28,7 +30,17 @@ enum ins_opcode_t {
 	ALLOC,	// Allocate memory
 	FREE,	// Deallocated a memory block
 	READ,	// Write data to a byte on memory
-	WRITE	// Read data from a byte on memory
+	WRITE,	// Read data from a byte on memory
+	LOCK,	// Take a mutex, waiting for it if it is held (sync.h)
+	UNLOCK,	// Release a mutex
+	WAIT,	// Take a unit of a semaphore, waiting for one if none is left
+	SIGNAL,	// Give a unit back to a semaphore
+	IO,	// Wait for a request on an I/O device (io.h)
+	SPAWN,	// Start a thread on the next instructions (thread.h)
+	JOIN,	// Wait for the threads it started
+	COPY,	// Copy a range of a region to a range of a region
+	FILL,	// Set every byte of a range of a region to a value
+	NR_OPCODES
 };
 
 /* instructions executed by the CPU */
@@ -37,10 +49,23 @@ struct inst_t {
 	uint32_t arg_0; // Argument lists for instructions
 	uint32_t arg_1;
 	uint32_t arg_2;
+	uint32_t arg_3;	// Only used by copy and fill
+	uint32_t arg_4;
+};
+
+/* An instruction decoded for the interpreter (cpu.c), 16 bytes: the
+ * address of its handler in run(), its opcode, and for calc the number of
+ * calc instructions in a row from this one, for the others the index of
+ * its operands in the pool that follows the ops (see code_args) */
+struct code_op {
+	const void * handler;
+	uint32_t opcode;
+	uint32_t arg;
 };
 
 struct code_seg_t {
 	struct inst_t * text;
+	struct code_op * ops;	// text decoded by cpu_decode, NULL until then
 	uint32_t size;
 };
 
@@ -63,13 +88,32 @@ struct page_table_t {
 	int size;	// Number of row in the first layer
 };
 
+/* Scheduling metrics of a process, in slots (stats.c) */
+struct proc_stats {
+	uint32_t pid;
+	uint32_t prio;
+	uint64_t arrival;	// Loaded
+	uint64_t first_run;	// First dispatched, UINT64_MAX before that
+	uint64_t finish;	// Finished
+	uint64_t run;		// Slots run
+	uint64_t wait;		// Slots spent in a ready queue
+	uint64_t ready_since;	// Last queued
+	uint64_t blocked;	// Slots spent waiting on sync objects
+	uint64_t blocked_since;	// Last started waiting on one
+	uint64_t switches;	// Times dispatched
+	uint64_t migrations;	// Times dispatched on another CPU than the last
+	uint64_t deadline;	// EDF: absolute deadline, 0 if it has none
+};
+
 /* PCB, describe information about a process */
 struct pcb_t {
+	struct sim_ctx * ctx;	// Simulation the process belongs to
 	uint32_t pid;	// PID
 	uint32_t priority; // Default priority, this legacy (FIXED) value depend on process itself
 	struct code_seg_t * code;	// Code segment
 	addr_t regs[10]; // Registers, store address of allocated regions
 	uint32_t pc; // Program pointer, point to the next instruction
+	uint32_t end; // pc it finishes at, code->size but for a thread
 #ifdef MLQ_SCHED
 	// Priority on execution (if supported), on-fly aka. changeable
 	// and this vale overwrites the default priority when it existed
@@ -84,6 +128,50 @@ struct pcb_t {
 	struct page_table_t * page_table; // Page table
 	uint32_t bp;	// Break pointer
 
+	/* sched.c: node of the red-black tree of the policy (see rbtree.h) */
+	struct pcb_t * rb_parent;
+	struct pcb_t * rb_left;
+	struct pcb_t * rb_right;
+	int rb_color;
+	uint64_t rb_key;
+	/* CFS and stride: weighted run time (the pass of stride) */
+	uint64_t vruntime;
+	/* Slot the process was last dispatched */
+	uint64_t exec_start;
+	/* CPU it last ran on (-1 if none yet) and the slot it stopped there */
+	int last_cpu;
+	uint64_t last_ran;
+	/* Lottery: index in lot_procs of its run queue */
+	int lot_index;
+	/* EDF: deadline and period relative to its arrival (0 if it has
+	 * none, the period is not re-released, see sched_admit), the CPU
+	 * share it was admitted with (0 if it was not, see DL_ONE), the
+	 * absolute deadline and the CPU holding the share */
+	uint64_t dl_rel;
+	uint64_t dl_period;
+	uint64_t dl_util;
+	uint64_t dl_deadline;
+	int dl_cpu;
+	/* sync.c: object it waits on, while it is blocked */
+	int wait_obj;
+	/* thread.c: pid of the process it is a thread of (its own for the
+	 * process), the one that spawned it, the threads it spawned that
+	 * still run and whether it waits for them, then its neighbours in
+	 * ctx->joiners */
+	uint32_t tgid;
+	struct pcb_t * parent;
+	int nr_threads;
+	int joining;
+	struct pcb_t * join_prev;
+	struct pcb_t * join_next;
+	/* group.c: index of its group in ctx->groups, and the slots of the
+	 * quota it reserved for its slice in the period from quota_period */
+	int group;
+	uint32_t quota_slots;
+	uint64_t quota_period;
+
+	struct proc_stats stats;
+
 };
 
 #endif
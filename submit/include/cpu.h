@@ -4,10 +4,32 @@
 
 #include "common.h"
 
+/* The process has to wait on a sync object, see sync_run */
+#define RUN_BLOCKED 2
+
 /* Execute an instruction of a process. Return 0
- * if the instruction is executed successfully.
+ * if the instruction is executed successfully,
+ * RUN_BLOCKED if the process cannot go on yet.
  * Otherwise, return 1. */
 int run(struct pcb_t * proc);
 
+/* Translate the text of [code] into code->ops, the form run() executes:
+ * the ops, then the operands of those that have any, packed in one pool.
+ * The text stays as the form the loader and checkpoints know; nothing
+ * executes it. The loader does it once per segment; a segment that comes
+ * without it (a restored checkpoint) is translated on its first run */
+void cpu_decode(struct code_seg_t * code);
+
+/* The operands of decoded instruction [op] of [code] */
+static inline const uint32_t *code_args(const struct code_seg_t *code,
+                                        const struct code_op *op) {
+  return (const uint32_t *)(code->ops + code->size) + op->arg;
+}
+
+/* Number of calc instructions in a row [proc] is to execute from its pc
+ * on, 0 if the next one is something else. Its CPU retires them one per
+ * slot without going through run() */
+uint32_t calc_run(struct pcb_t * proc);
+
 #endif
 
@@ -0,0 +1,57 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "common.h"
+
+#include <pthread.h>
+
+struct sim_ctx;
+
+/* Groups of a simulation (the default one included) and their longest
+ * name */
+#define GROUP_MAX 16
+#define GROUP_NAME_LEN 16
+
+/* Group of the processes without a tag, always ctx->groups[0] */
+#define GROUP_DEFAULT "default"
+
+/*
+ * Process groups
+ *  A process line of the configure file ending in "@[name]" puts the
+ *  process (and its threads) in that group, the others are in the default
+ *  group. Under the group policy the groups of a CPU share it by their
+ *  shares, whatever the number of their processes, and a group with a
+ *  quota runs at most quota slots, over all CPUs, in each period: CPUs
+ *  reserve its run time one slice at a time. A CPU that finds the group
+ *  out of quota parks it, with all of its processes queued there, until
+ *  the next period (see rq_pick_quota). The other policies ignore groups.
+ */
+struct sched_group {
+  pthread_mutex_t lock; /* The quota state */
+  char name[GROUP_NAME_LEN];
+  uint32_t shares;
+  uint32_t quota;  /* Slots per period, 0 for no limit */
+  uint32_t period; /* In slots */
+  uint64_t period_start;
+  uint32_t used; /* Of the quota in this period, reserved included */
+  uint64_t run;       /* Slots its processes ran */
+  uint64_t throttled; /* Times a CPU parked it out of quota */
+};
+
+/* Index of the group called [name] in ctx->groups, created with the
+ * default shares and no quota if it is new. -1 if the table is full or
+ * the name too long */
+int group_lookup(struct sim_ctx *ctx, const char *name);
+
+/* [proc], just picked to run, takes a slice of the quota of its group.
+ * Return 0 if the group has used all of its quota in this period, with
+ * [until] set to the slot the next one starts at */
+int group_reserve(struct sim_ctx *ctx, struct pcb_t *proc, uint64_t *until);
+
+/* [proc] stopped after [ran] slots, charge them to its group and give
+ * back what it reserved and did not use */
+void group_charge(struct sim_ctx *ctx, struct pcb_t *proc, uint64_t ran);
+
+void group_destroy(struct sim_ctx *ctx);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef IO_H
+#define IO_H
+
+#include "common.h"
+
+struct sim_ctx;
+
+/* Named devices of a simulation, their longest name and the most requests
+ * one serves at once */
+#define IO_MAX_DEVS 8
+#define IO_NAME_LEN 16
+#define IO_MAX_DEPTH 16
+
+/*
+ * I/O devices
+ *  "io [device] [slots]" takes a process off its CPU for a request of
+ *  [slots] slots on the named device. A device serves up to depth
+ *  requests at once, each for its latency plus its slots, the others wait
+ *  in arrival order. Requests never overtake each other, so the slot one
+ *  completes at is known when it is submitted: the I/O controller of the
+ *  simulation (sim.c) only hands the process back to the scheduler then.
+ */
+struct io_device {
+  char name[IO_NAME_LEN];
+  int latency; /* Slots added to every request */
+  int depth;   /* Requests served at once */
+  /* Slot each of the depth channels is free again */
+  uint64_t free_at[IO_MAX_DEPTH];
+  uint64_t requests;
+  uint64_t wait_slots;    /* In its queue, before service */
+  uint64_t service_slots; /* In service (latency included) */
+};
+
+/* A request in flight, until slot done */
+struct io_req {
+  uint64_t done;
+  uint64_t seq; /* Submission order, to complete ties in it */
+  struct pcb_t *proc;
+  int dev;
+};
+
+/* Index of the device called [name] in ctx->io, created with [latency]
+ * and [depth] if it is new. -1 if the table is full or the name too
+ * long */
+int io_lookup(struct sim_ctx *ctx, const char *name, int latency, int depth);
+
+/* [proc], stopped by its CPU, issues a request of [slots] slots on device
+ * [id]. Return the slot it completes at */
+uint64_t io_submit(struct sim_ctx *ctx, struct pcb_t *proc, int id,
+                   uint32_t slots);
+
+/* Hand the processes whose request completes by now back to the
+ * scheduler, return how many. [next] is set to the slot the next one
+ * completes at, UINT64_MAX if no request is in flight */
+int io_complete(struct sim_ctx *ctx, uint64_t *next);
+
+/* Free the table of requests */
+void io_destroy(struct sim_ctx *ctx);
+
+#endif
@@ -3,7 +3,7 @@
 
 #include "common.h"
 
-struct pcb_t * load(const char * path);
+struct pcb_t * load(struct sim_ctx * ctx, const char * path);
 
 #endif
 
@@ -3,6 +3,8 @@
 #include "bitops.h"
 #include "common.h"
 
+#include <stdio.h>
+
 /* CPU Bus definition */
 #define PAGING_CPU_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
 #define PAGING_PAGESZ  256      /* 256B or 8-bits PAGE NUMBER */
@@ -115,6 +117,10 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+int __copy(struct pcb_t *caller, int vmaid, int srcrg, int srcoff, int dstrg,
+           int dstoff, int len);
+int __fill(struct pcb_t *caller, int vmaid, int rgid, int offset, int len,
+           BYTE value);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
 
 /* VM prototypes */
@@ -130,6 +136,19 @@ int pgwrite(
 		BYTE data, // Data to be wrttien into memory
 		uint32_t destination, // Index of destination register
 		uint32_t offset);
+int pgcopy(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t source, // Index of source register
+		uint32_t srcoff, // Source address = [source] + [srcoff]
+		uint32_t destination, // Index of destination register
+		uint32_t dstoff, // Destination address = [destination] + [dstoff]
+		uint32_t len); // Number of bytes
+int pgfill(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t destination, // Index of destination register
+		uint32_t offset, // First address = [destination] + [offset]
+		uint32_t len, // Number of bytes
+		BYTE data); // Value written to each of them
 /* Local VM prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
@@ -144,7 +163,10 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
 int MEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
-int MEMPHY_dump(struct memphy_struct * mp);
+int MEMPHY_read_block(struct memphy_struct * mp, int addr, BYTE *buf, int len);
+int MEMPHY_write_block(struct memphy_struct * mp, int addr, const BYTE *buf,
+                       int len);
+int MEMPHY_dump(struct memphy_struct * mp, FILE * out);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
 /* DEBUG */
 int print_list_fp(struct framephy_struct *fp);
@@ -4,6 +4,45 @@
 #define MLQ_SCHED 1
 #define MAX_PRIO 140
 
+/* Skip slots in which every device is idle or asleep, the slot trace is
+ * still printed for each skipped slot */
+#define TIMER_FASTFWD 1
+
+/* Per-device state written on every slot is kept on its own cache line
+ * of this size */
+#define CACHE_LINE_SIZE 64
+#define CACHELINE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
+/* CFS defaults, in slots: every runnable process of a CPU runs once per
+ * target latency, but no slice is shorter than the minimum granularity.
+ * "policy cfs [latency] [granularity]" in the configure file overrides
+ * them */
+#define CFS_TARGET_LATENCY 6
+#define CFS_MIN_GRANULARITY 1
+
+/* Cache affinity, in slots: an idle CPU does not steal a process that ran
+ * on its CPU less than the window ago, and a process dispatched on
+ * another CPU than the last one first stalls for the penalty (its slice
+ * is that much longer). "affinity [window] [penalty]" in the configure
+ * file overrides them, 0 turns either off */
+#define AFFINITY_WINDOW 0
+#define MIGRATION_PENALTY 0
+
+/* A new process that outranks a running one (a lower MLQ priority, an
+ * earlier EDF deadline) takes its CPU at the next instruction instead of
+ * waiting for the end of the slice. "preempt off" in the configure file
+ * turns it off */
+#define SCHED_PREEMPT 1
+
+/* Latency and depth, in slots and requests served at once, of an I/O
+ * device that no "device [name] [latency] [depth]" line declares */
+#define IO_LATENCY 2
+#define IO_QUEUE_DEPTH 1
+
+/* CPU shares of a process group that no "group [name] [shares]" line
+ * sets, that of a nice 0 process under CFS */
+#define GROUP_SHARES 1024
+
 //#define MM_PAGING// predefined
 //#define MM_FIXED_MEMSZ
 //#define VMDBG 1
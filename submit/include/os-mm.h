@@ -80,13 +80,18 @@ struct memphy_struct {
    /* Basic field of data and size */
    BYTE *storage;
    int maxsz;
+   /* One past the last byte ever written, MEMPHY_dump stops there */
+   int dump_end;
    
    /* Sequential device fields */ 
    int rdmflg;
    int cursor;
 
-   /* Management structure */
+   /* Management structure. Frames from fresh_fpn to fresh_end were never
+    * handed out, they are free without being in free_fp_list */
    struct framephy_struct *free_fp_list;
+   int fresh_fpn;
+   int fresh_end;
    struct framephy_struct *used_fp_list;
 };
 
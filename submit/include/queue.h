@@ -4,24 +4,33 @@
 
 #include "common.h"
 
-#define MAX_QUEUE_SIZE 10
+/* Capacity of a queue the first time something is enqueued */
+#define QUEUE_INIT_SIZE 8
 
 /**
  * @struct queue_t
  * @brief Represents a queue data structure for storing process control blocks
  * (PCBs).
  *
- * The queue_t struct contains an array of pointers to PCBs, the size of the
- * queue, and an optional field for CPU remainder (used in MLQ scheduling).
+ * The queue_t struct is a ring buffer of pointers to PCBs that doubles when
+ * full, the number of queued PCBs, and an optional field for CPU remainder
+ * (used in MLQ scheduling). A zeroed queue_t is an empty queue.
  */
 struct queue_t {
-  struct pcb_t *proc[MAX_QUEUE_SIZE]; /**< Array of pointers to PCBs */
-  int size;                           /**< Size of the queue */
+  struct pcb_t **proc; /**< Ring of pointers to PCBs, cap entries */
+  int head;            /**< Index of the oldest PCB in proc */
+  int size;            /**< Size of the queue */
+  int cap;             /**< Number of entries allocated in proc */
 #ifdef MLQ_SCHED
   int cpuRemainder; /**< CPU remainder for MLQ scheduling */
 #endif
 };
 
+void init_queue(struct queue_t *q);
+
+/* Release the ring, the queued PCBs are not freed */
+void free_queue(struct queue_t *q);
+
 void enqueue(struct queue_t *q, struct pcb_t *proc);
 
 struct pcb_t *dequeue(struct queue_t *q);
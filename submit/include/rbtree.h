@@ -0,0 +1,36 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "common.h"
+
+/*
+ * Red-black tree of PCBs, ordered by pcb_t.rb_key
+ *  The nodes are the PCBs themselves (rb_parent, rb_left, rb_right and
+ *  rb_color), so inserting never allocates. Processes with the same key
+ *  stay in insertion order. The process with the smallest key is cached,
+ *  rb_first is O(1), rb_insert and rb_erase are O(log n).
+ */
+struct rb_tree {
+  struct pcb_t *root;
+  struct pcb_t *leftmost;
+  int size;
+};
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+void rb_init(struct rb_tree *t);
+
+/* Insert [proc] with its current rb_key, it must not be in a tree */
+void rb_insert(struct rb_tree *t, struct pcb_t *proc);
+
+/* Remove [proc] from [t], its node links are cleared */
+void rb_erase(struct rb_tree *t, struct pcb_t *proc);
+
+/* Process with the smallest key, NULL if the tree is empty */
+static inline struct pcb_t *rb_first(struct rb_tree *t) { return t->leftmost; }
+
+/* Process after [proc] in key order, NULL if it is the last */
+struct pcb_t *rb_next(struct pcb_t *proc);
+
+#endif
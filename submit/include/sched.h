@@ -1,36 +1,263 @@
-#ifndef QUEUE_H
-#define QUEUE_H
+#ifndef SCHED_H
+#define SCHED_H
 
+#include "bitops.h"
 #include "common.h"
+#include "group.h"
 #include "queue.h"
+#include "rbtree.h"
+
+#include <pthread.h>
 
 #ifndef MLQ_SCHED
 #define MLQ_SCHED
 #endif
 
-#define MAX_PRIO 139
+struct sim_ctx;
+struct cpu_args;
+
+/* Scheduling policy, "policy" line of the configure file or os -P */
+enum sched_policy {
+  POLICY_MLQ,     /* Fixed time_slot, priority queues with cpuRemainder */
+  POLICY_CFS,     /* Weighted virtual run time, slice from the target latency */
+  POLICY_FIFO,    /* One queue in arrival order, fixed time_slot */
+  POLICY_STRIDE,  /* Smallest pass first, pass grows by the stride per slot */
+  POLICY_LOTTERY, /* Random draw weighted by tickets, fixed time_slot */
+  POLICY_GROUP,   /* Groups by virtual time over shares, then processes by
+                   * weighted virtual time inside a group, fixed time_slot */
+  NUM_POLICIES
+};
+
+/* Part of a run queue of one process group, under the group policy */
+struct grp_rq {
+  struct rb_tree tree;   /* Its queued processes by virtual time */
+  uint64_t vruntime;     /* Of the group, grows over its shares */
+  uint64_t min_vruntime; /* Floor for its processes, as under CFS */
+  int heap_index;        /* In grp_heap, -1 while it has nothing to pick */
+  int throttled;         /* Parked out of quota, off grp_heap */
+};
+
+/*
+ * Run queues of one CPU
+ *  Every CPU dispatches from its own queues under its own lock. New
+ *  processes go to the least loaded online CPU, and a CPU whose queues are
+ *  empty steals from the one with the most queued processes. Each policy
+ *  keeps its processes in its own part of the run queue.
+ */
+struct cpu_rq {
+  pthread_mutex_t lock;
+
+  /* EDF, ahead of the policy: processes with a deadline in a min-heap on
+   * it (dl_size of dl_cap entries), and the utilization admitted on this
+   * CPU, of DL_ONE */
+  struct pcb_t **dl_heap;
+  int dl_size;
+  int dl_cap;
+  uint64_t dl_util;
+
+  /* FIFO */
+  struct queue_t fifo_queue;
+
+  /* MLQ */
+  struct queue_t mlq_ready_queue[MAX_PRIO];
+  /* Priorities whose queue is not empty, and those of them that also have
+   * cpuRemainder left (what get_proc picks from) */
+  unsigned long mlq_nonempty[BITS_TO_LONGS(MAX_PRIO)];
+  unsigned long mlq_ready[BITS_TO_LONGS(MAX_PRIO)];
+
+  /* CFS and stride: queued processes ordered by virtual time (vruntime,
+   * which is the pass under stride), their total weight, and the floor
+   * new and migrated processes start from */
+  struct rb_tree vt_tree;
+  uint64_t vt_load;
+  uint64_t min_vruntime;
+  uint64_t curr_vruntime; /* Of the running process, if curr */
+
+  /* Group: the groups with queued processes in a min-heap on their
+   * virtual time (grp_nr of them), the floor of a group that has some
+   * again, and the group of the running process (-1 if none). The
+   * shares are read from groups, which is ctx->groups */
+  struct grp_rq grp[GROUP_MAX];
+  int grp_heap[GROUP_MAX];
+  int grp_nr;
+  uint64_t grp_min_vruntime;
+  int grp_curr;
+  const struct sched_group *groups;
+  /* Groups parked here out of quota, the slot each one gets its quota
+   * back, the first of those slots and the processes queued in them
+   * (which nr_queued leaves out) */
+  unsigned long grp_throttled[BITS_TO_LONGS(GROUP_MAX)];
+  uint64_t grp_until[GROUP_MAX];
+  uint64_t grp_unthrottle;
+
+  /* Lottery: the lot_nr queued processes in no order, a Fenwick tree
+   * over their tickets (lot_cap entries each) and the state of the draw */
+  struct pcb_t **lot_procs;
+  uint64_t *lot_tickets;
+  int lot_nr;
+  int lot_cap;
+  uint64_t lot_total;
+  uint64_t lot_seed;
+
+  /* Load seen by other CPUs, written under lock and read without */
+  int nr_queued; /* Processes in the queues */
+  int curr;      /* The CPU is running a process */
+  /* Preemption rank of the running process (see add_proc), 0 once a new
+   * process is to take its place */
+  uint64_t curr_rank;
+  uint32_t curr_tgid; /* tgid of the running process, 0 if none */
+
+  /* Times lock was taken only after waiting for another thread */
+  uint64_t contended;
+  /* Processes this CPU stole from other CPUs */
+  uint64_t migrations;
+} CACHELINE_ALIGNED;
+
+/*
+ * A scheduling policy (sched-policy.c)
+ *  The policy only orders the processes queued on one run queue, its
+ *  operations are called with the lock of that run queue held. Moving
+ *  processes between CPUs, parking and the load counts are left to
+ *  sched.c.
+ */
+struct sched_class {
+  const char *name;
+  /* Set up and release the part of [rq] of this policy */
+  void (*init)(struct cpu_rq *rq, int cpu);
+  void (*destroy)(struct cpu_rq *rq);
+  void (*enqueue)(struct cpu_rq *rq, struct pcb_t *proc);
+  /* Dequeue the process to run next, NULL if there is none. With [steal]
+   * the process is for another CPU */
+  struct pcb_t *(*pick)(struct cpu_rq *rq, int steal);
+  /* The process pick would take with [steal] set, left queued */
+  struct pcb_t *(*peek)(struct cpu_rq *rq);
+  /* The CPU of [rq] starts running [proc] / stops after [ran] slots */
+  void (*start)(struct cpu_rq *rq, struct pcb_t *proc);
+  void (*stop)(struct cpu_rq *rq, struct pcb_t *proc, uint64_t ran);
+  /* [proc], just picked, leaves [rq] for another CPU / joins [rq] (new
+   * processes too) */
+  void (*detach)(struct cpu_rq *rq, struct pcb_t *proc);
+  void (*attach)(struct cpu_rq *rq, struct pcb_t *proc);
+  /* Slots [proc], just started, runs before it is put back */
+  int (*slice)(struct sim_ctx *ctx, struct cpu_rq *rq, struct pcb_t *proc);
+  /* Order of [proc] for preemption, the lower runs first: a new process
+   * ranked below a running one takes its CPU at once. NULL if the policy
+   * never preempts */
+  uint64_t (*rank)(struct pcb_t *proc);
+  /* Group [group] is out of quota: no more picks from it / picks again.
+   * Return the processes it has queued on [rq]. NULL if the policy has
+   * no groups */
+  int (*throttle)(struct cpu_rq *rq, int group);
+  int (*unthrottle)(struct cpu_rq *rq, int group);
+};
+
+extern const struct sched_class *const sched_classes[NUM_POLICIES];
+
+/* Real-time class of the processes with a deadline, runs ahead of the
+ * policy on every CPU */
+extern const struct sched_class edf_class;
+
+/* Utilization of a whole CPU, in the fixed point of pcb_t.dl_util */
+#define DL_ONE ((uint64_t)1 << 20)
+
+/* The enum sched_policy called [name], -1 if there is none */
+int sched_policy_by_name(const char *name);
 
-int queue_empty(void);
+/* Scheduler of one simulation */
+struct sched_struct {
+  /* Run queues, one per CPU (max_cpus) */
+  struct cpu_rq *rq;
 
-void init_scheduler(void);
-void finish_scheduler(void);
+  /* Protects the parked ring */
+  pthread_mutex_t queue_lock;
+
+  /* Ring of the CPUs parked in sched_park, the longest parked is woken
+   * first */
+  int *parked;
+  int parked_head;
+  int num_parked;
+};
+
+int queue_empty(struct sim_ctx *ctx);
+
+void init_scheduler(struct sim_ctx *ctx);
+void finish_scheduler(struct sim_ctx *ctx);
 
 //void incrNumberOfCpuCanUse(struct queue_t *q);
 
 //void decrNumberOfCpuCanUse(struct queue_t *q);
 
-/* Get the next process from ready queue */
-struct pcb_t * get_proc(void);
+/* Every process is loaded, and those not finished (if any) all wait on
+ * sync objects or threads, for one another */
+int sched_finished(struct sim_ctx *ctx);
 
-/* Put a process back to run queue */
-void put_proc(struct pcb_t * proc);
+/* No process can become runnable any more: every one is loaded, no CPU
+ * is left to drain, none waits for I/O, and those not running or
+ * finished (if any) are stuck on sync objects as in sched_finished */
+int sched_done(struct sim_ctx *ctx);
 
-/* Add a new process to ready queue */
-void add_proc(struct pcb_t * proc);
+/* Park an idle CPU until a process becomes runnable. Return 0 (and do
+ * not park) if get_proc could succeed already or no process will come */
+int sched_park(struct sim_ctx *ctx, struct cpu_args *cpu);
 
-/* Handle when proc is done*/
-void finish_proc(struct pcb_t ** proc);
+/* Wake a parked CPU for another reason (hotplug) */
+void sched_unpark(struct sim_ctx *ctx, struct cpu_args *cpu);
 
-#endif
+/* Wake every parked CPU, e.g. once the loader is done, and the I/O
+ * controller */
+void sched_wake_all(struct sim_ctx *ctx);
+
+/* Park the I/O controller while no request is in flight. Return 0 (and
+ * do not park) if one was submitted meanwhile or sched_finished holds,
+ * the controller then leaves */
+int sched_park_io(struct sim_ctx *ctx);
+
+/* A request was submitted, wake the I/O controller if it is parked */
+void sched_wake_io(struct sim_ctx *ctx);
+
+/* Move the processes queued on CPU [cpu], which went offline, to the
+ * online CPUs */
+void sched_drain(struct sim_ctx *ctx, int cpu);
+
+/* Get the next process for CPU [cpu] from its ready queue, or steal one
+ * from another CPU. Clears the need_resched of the CPU */
+struct pcb_t * get_proc(struct sim_ctx *ctx, int cpu);
+
+/* Slots CPU [cpu] runs [proc], just dispatched by get_proc, before it
+ * puts it back: no more than its group has reserved */
+int sched_slice(struct sim_ctx *ctx, int cpu, struct pcb_t * proc);
 
+/* Slot the first group parked on CPU [cpu] out of quota gets it back,
+ * UINT64_MAX if none is */
+uint64_t sched_throttled(struct sim_ctx *ctx, int cpu);
+
+/* Put a process CPU [cpu] was running back to its run queue */
+void put_proc(struct sim_ctx *ctx, int cpu, struct pcb_t * proc);
+
+/* Admission control of a new process with a deadline (dl_rel): reserve
+ * its utilization, its instruction count over the lesser of dl_rel and
+ * dl_period (if it has one), on the online CPU with the least of it
+ * admitted, where add_proc will queue it. Return that CPU, or -1 if the
+ * process has no deadline or fits nowhere; it is then scheduled by the
+ * policy. The period only sizes the reservation: the process is released
+ * once, on arrival, and no later job of it is ever released */
+int sched_admit(struct sim_ctx *ctx, struct pcb_t * proc);
+
+/* Add a new process to the ready queue of the least loaded CPU. If every
+ * CPU is busy and the process ranks above one of the running processes,
+ * it goes to the CPU running the lowest ranked of them instead, and that
+ * CPU is told to reschedule (cpu_args.need_resched) */
+void add_proc(struct sim_ctx *ctx, struct pcb_t * proc);
+
+/* [proc], run by CPU [cpu], has to wait on a sync object: stop it
+ * without queuing it anywhere */
+void block_proc(struct sim_ctx *ctx, int cpu, struct pcb_t * proc);
+
+/* Queue [proc] again, it got the sync object it waited on */
+void wake_proc(struct sim_ctx *ctx, struct pcb_t * proc);
+
+/* Handle when proc, run by CPU [cpu], is done*/
+void finish_proc(struct sim_ctx *ctx, int cpu, struct pcb_t ** proc);
+
+#endif
 
@@ -0,0 +1,205 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "common.h"
+#include "group.h"
+#include "io.h"
+#include "sched.h"
+#include "sync.h"
+#include "timer.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+/* Processes listed in the configure file */
+struct ld_args {
+  char **path;
+  unsigned long *start_time;
+#ifdef MLQ_SCHED
+  unsigned long *prio;
+#endif
+  /* Optional: relative deadline and period, 0 if none (see sched_admit) */
+  unsigned long *deadline;
+  unsigned long *period;
+  /* Index in ctx->groups, 0 (the default group) without an "@" tag */
+  int *group;
+};
+
+/* "cpus [slot] [n]" line of the configure file: from [slot] on, CPUs
+ * 0..n-1 are online */
+struct hotplug_event {
+  uint64_t slot;
+  int num_cpus;
+};
+
+/* The loader device, it also applies the hotplug events */
+struct ld_dev {
+  struct sim_ctx *ctx;
+  struct timer_id_t *timer_id;
+  int next;         /* Index of the next process to load */
+  int next_hotplug; /* Index of the next hotplug event */
+  uint64_t wake;    /* Slot of the next arrival or hotplug event */
+} CACHELINE_ALIGNED;
+
+/* The I/O controller device, it hands the processes back once their
+ * request completes (io.c) */
+struct io_ctl {
+  struct sim_ctx *ctx;
+  struct timer_id_t *timer_id;
+  int parked;    /* No request in flight, see sched_park_io */
+  int exited;    /* Left the simulation */
+  uint64_t wake; /* Slot the next request completes at */
+} CACHELINE_ALIGNED;
+
+enum cpu_state {
+  CPU_ONLINE,
+  CPU_DRAINING, /* Asked to go offline, leaves on its next step */
+  CPU_OFFLINE   /* Out of the slot barrier */
+};
+
+/* A simulated CPU
+ *  Written by its own host thread on every step, so each one gets whole
+ *  cache lines to itself in the cpus array. */
+struct cpu_args {
+  struct sim_ctx *ctx;
+  struct timer_id_t *timer_id;
+  int id;
+  struct pcb_t *proc; /* Running process */
+  int time_left;      /* Slots left in its time slice */
+  int stall;          /* Of those, slots left refilling a cold cache */
+  int calc_left;      /* Of those, calcs proc runs next (see calc_run) */
+  uint64_t run_ahead; /* Slice mode: first slot it has not run yet */
+  int state;          /* enum cpu_state, changed with atomics */
+  int parked;         /* Waiting in sched_park for a process */
+  int need_resched;   /* A process that preempts proc was queued here */
+  uint64_t wake;      /* Slot a group parked on it gets its quota back */
+  uint64_t last_slot; /* Last slot it was stepped in */
+  uint64_t idle_slots;
+  uint64_t busy_slots;
+  uint64_t stall_slots; /* Busy, but stalled after a migration */
+  pthread_t thread;   /* Host thread of the threaded engine */
+  int has_thread;     /* thread is still to be joined */
+} CACHELINE_ALIGNED;
+
+/*
+ * Simulation context
+ *  Everything a simulation run owns lives here, so several simulations
+ *  can run side by side in one host process.
+ */
+struct sim_ctx {
+  /* Configuration */
+  int time_slot;
+  int num_cpus; /* Online at slot 0 */
+  int max_cpus; /* Online at any time, the size of cpus */
+  int num_processes;
+  struct ld_args ld_processes;
+  struct hotplug_event *hotplug;
+  int num_hotplug;
+  int policy; /* enum sched_policy */
+  int cfs_latency;
+  int cfs_min_gran;
+  int affinity_window;   /* See AFFINITY_WINDOW */
+  int migration_penalty; /* See MIGRATION_PENALTY */
+  int preempt;           /* See SCHED_PREEMPT */
+#ifdef MM_PAGING
+  int memramsz;
+  int memswpsz[PAGING_MAX_MMSWP];
+#endif
+
+  /* Run all devices from the calling thread (see sim_run) */
+  int sequential;
+  /* If not 0, step the devices on this many host threads instead of one
+   * thread per device */
+  int workers;
+  /* Pin the host thread of every device to a host core */
+  int pin;
+  /* Run the calcs of a time slice in one go, see cpu_step */
+  int slice_mode;
+
+  /* Devices */
+  struct ld_dev ld;
+  struct io_ctl ioc;
+  struct cpu_args *cpus;
+#ifdef MM_PAGING
+  struct memphy_struct mram;
+  struct memphy_struct mswp[PAGING_MAX_MMSWP];
+#endif
+
+  /* loader.c */
+  uint32_t avail_pid;
+  int done; /* All processes have been loaded */
+  /* EDF admission control, and the deadlines missed (stats.c) */
+  int dl_admitted;
+  int dl_rejected;
+  int dl_missed;
+  /* CPUs taken offline that have not handed their processes on yet */
+  int nr_draining;
+
+  /* timer.c */
+  struct timer_struct timer;
+
+  /* sched.c */
+  struct sched_struct sched;
+
+  /* sync.c: named objects (nr_sync of them) and the processes waiting on
+   * them */
+  struct sync_obj sync[SYNC_MAX_OBJS];
+  int nr_sync;
+  int nr_blocked;
+
+  /* io.c: devices (nr_io_devs of them), the requests in flight in a
+   * min-heap on their completion slot (io_nreq of io_cap) and the
+   * processes waiting for one, counted out once they are queued again */
+  struct io_device io[IO_MAX_DEVS];
+  int nr_io_devs;
+  struct io_req *io_reqs;
+  int io_nreq;
+  int io_cap;
+  uint64_t io_seq;
+  int nr_io;
+  pthread_mutex_t io_lock;
+
+  /* group.c: process groups, the default one first */
+  struct sched_group groups[GROUP_MAX];
+  int nr_groups;
+
+  /* thread.c: threads spawned so far, each one a process of its own to
+   * the scheduler and the metrics, and the processes waiting for theirs,
+   * linked through join_next under thread_lock */
+  int nr_threads;
+  struct pcb_t *joiners;
+  pthread_mutex_t thread_lock;
+
+  /* stats.c: records of the finished processes, room for finished_cap */
+  struct proc_stats *finished;
+  int nr_finished;
+  int finished_cap;
+  pthread_mutex_t stats_lock;
+
+  /* mm-vm.c: synchronized for vm */
+  pthread_mutex_t vm_lock;
+
+  /* Trace output of the simulation */
+  FILE *out;
+
+  /* ckpt.c: snapshot to write once the clock reaches ckpt_slot
+   * (sequential engine only), and the snapshot this run was restored from */
+  const char *ckpt_path;
+  uint64_t ckpt_slot;
+  void *ckpt_map;
+  size_t ckpt_size;
+};
+
+/* Read the configure file at [path] and set up every device.
+ * Return 0 on success, -1 if the configuration cannot be read; ctx then
+ * holds nothing to free and sim_destroy must not be called on it */
+int sim_init(struct sim_ctx *ctx, const char *path, FILE *out);
+
+/* Run the simulation until every CPU has stopped, then report the idle
+ * slots of each CPU. A context restored by ckpt_restore resumes at the
+ * slot the snapshot was taken */
+void sim_run(struct sim_ctx *ctx);
+
+void sim_destroy(struct sim_ctx *ctx);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+struct sim_ctx;
+
+/*
+ * Scheduling metrics
+ *  Every PCB carries a struct proc_stats, kept up to date by the loader
+ *  and the scheduler with a few additions per dispatch. A finished
+ *  process leaves its record in ctx->finished; together with the busy and
+ *  idle slots of each CPU they make the report written at exit.
+ *
+ *  turnaround = finish - arrival, response = first_run - arrival,
+ *  waiting = slots spent in a ready queue, blocked = slots spent waiting
+ *  on sync objects or I/O requests, migration_rate = percent of
+ *  the dispatches on another CPU than the last one, lateness = finish -
+ *  deadline of the processes admitted with one. The JSON report adds the
+ *  throughput (processes finished per slot) and the load of each I/O
+ *  device.
+ */
+
+/* [proc] was just loaded, at the current slot */
+void stats_arrive(struct sim_ctx *ctx, struct pcb_t *proc);
+
+/* [proc] is done, keep its record before it is freed */
+void stats_finish(struct sim_ctx *ctx, struct pcb_t *proc);
+
+/* Write the report to [path]: JSON (every process and CPU, and the
+ * summary) if the name ends in ".json", or else the summary as CSV, one
+ * metric per row with its mean and percentiles. Return 0 on success */
+int stats_write(struct sim_ctx *ctx, const char *path);
+
+#endif
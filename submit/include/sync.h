@@ -0,0 +1,65 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "common.h"
+#include "queue.h"
+
+#include <pthread.h>
+
+struct sim_ctx;
+
+/* Named objects of a simulation, and the longest name */
+#define SYNC_MAX_OBJS 32
+#define SYNC_NAME_LEN 16
+
+/*
+ * Synchronization objects
+ *  Mutexes and counting semaphores named in the process files ("lock m",
+ *  "unlock m", "wait s", "signal s"). A process that cannot take one
+ *  leaves its CPU and waits in the FIFO of the object, out of the run
+ *  queues. A release hands the object straight to the oldest waiter and
+ *  queues only that one again, so no waiter runs just to find it taken.
+ */
+
+enum sync_kind {
+  SYNC_MUTEX, /* Held by one process, released by it only */
+  SYNC_SEM    /* Counting semaphore, "sem [name] [count]" line to start
+               * above 0 */
+};
+
+struct sync_obj {
+  pthread_mutex_t lock;
+  char name[SYNC_NAME_LEN];
+  int kind;       /* enum sync_kind */
+  int count;      /* Units free, at most 1 for a mutex */
+  uint32_t owner; /* Mutex: pid holding it, 0 if free */
+  struct queue_t waiters;
+  uint64_t acquired; /* Times a process got it */
+  uint64_t blocked;  /* Of those, after waiting for it */
+};
+
+/* Index of the object called [name] in ctx->sync, created with [count]
+ * units if it is new. -1 if there is one of another kind or the table is
+ * full */
+int sync_lookup(struct sim_ctx *ctx, const char *name, int kind, int count);
+
+/* Run LOCK, UNLOCK, WAIT or SIGNAL ([opcode]) on sync object [id] for
+ * [proc]. Return 0
+ * once done, 1 if proc does not hold the mutex it unlocks (or locks it
+ * again), or RUN_BLOCKED: proc has to wait, its CPU stops it and calls
+ * sync_sleep */
+int sync_run(struct pcb_t *proc, uint32_t opcode, uint32_t id);
+
+/* [proc], stopped by its CPU after sync_run blocked it, waits on the
+ * object; it is queued again right away if the object was released in
+ * between */
+void sync_sleep(struct sim_ctx *ctx, struct pcb_t *proc);
+
+/* [proc] is done, hand on the mutexes it still holds */
+void sync_exit(struct sim_ctx *ctx, struct pcb_t *proc);
+
+/* Release the objects and the processes left waiting on them (a
+ * deadlock) */
+void sync_destroy(struct sim_ctx *ctx);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "common.h"
+
+struct sim_ctx;
+
+/*
+ * Threads
+ *  "spawn [n]" starts a thread on the next n instructions, and the
+ *  process carries on after them. The thread is a PCB of its own with
+ *  its own pid, pc and registers, scheduled like any process. It shares
+ *  the code, the memory (mm, page table and symbol table) and tgid with
+ *  the process, and finishes at the end of those n instructions. "join"
+ *  waits until every thread the process spawned has finished. A process
+ *  (or thread) that reaches its end with threads still running waits for
+ *  them the same way before it finishes, so the memory it shares outlives
+ *  them.
+ */
+
+/* Run SPAWN for [proc]: start a thread on its next [n] instructions.
+ * Return 0, or 1 if the thread would run past the end of proc */
+int thread_spawn(struct pcb_t *proc, uint32_t n);
+
+/* Return 0 if [proc] has no thread left running, or else RUN_BLOCKED:
+ * its CPU stops it and calls thread_sleep */
+int thread_join(struct pcb_t *proc);
+
+/* [proc], stopped by its CPU after thread_join blocked it, waits for its
+ * threads; it is queued again right away if they finished in between */
+void thread_sleep(struct sim_ctx *ctx, struct pcb_t *proc);
+
+/* Thread [proc] is done, wake the process waiting for it if it was the
+ * last one */
+void thread_exit(struct sim_ctx *ctx, struct pcb_t *proc);
+
+/* Release the processes left waiting for their threads (a deadlock) */
+void thread_destroy(struct sim_ctx *ctx);
+
+#endif
@@ -1,28 +1,98 @@
+
 #ifndef TIMER_H
 #define TIMER_H
 
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include "os-cfg.h"
 
+struct timer_struct;
+
+/* A device (CPU or loader) taking part in the slot barrier. The barrier
+ * state itself is shared by all devices of a timer, a device only keeps
+ * track of whether it has left the simulation and, while it sleeps, of
+ * the slot it wants to be woken at. */
 struct timer_id_t {
-	int done;
+	struct timer_struct * timer;
 	int fsh;
-	pthread_cond_t event_cond;
-	pthread_mutex_t event_lock;
-	pthread_cond_t timer_cond;
-	pthread_mutex_t timer_lock;
+	uint32_t asleep;	/* futex word, set while out of the barrier */
+	uint64_t wake;		/* slot to rejoin the barrier at */
+} CACHELINE_ALIGNED;
+
+/* Clock and slot barrier of one simulation
+ *  Fields are grouped by who writes them: every arriving device, only the
+ *  device that closes the slot, or nobody on the fast path. */
+struct timer_struct {
+	/* Arrived devices (low half) and attached devices (high half) */
+	uint64_t barrier_state CACHELINE_ALIGNED;
+	/* Set by every device that did some work in the current slot */
+	int slot_busy;
+	/* Earliest slot an idle_until device has work again */
+	uint64_t slot_hint;
+
+	/* futex word, bumped once per slot */
+	uint32_t barrier_gen CACHELINE_ALIGNED;
+	uint64_t time;
+
+	struct timer_id_container_t * dev_list CACHELINE_ALIGNED;
+	int started;
+
+	/* Sleeping devices, min-heap on their wakeup slot */
+	pthread_mutex_t sleep_lock;
+	struct timer_id_t ** sleep_heap;
+	int sleep_size;
+	int sleep_cap;
+
+	/* Where the slot trace goes */
+	FILE * out;
 };
 
-void start_timer();
+void init_timer(struct timer_struct * timer, FILE * out);
 
-void stop_timer();
+void start_timer(struct timer_struct * timer);
 
-struct timer_id_t * attach_event();
+void stop_timer(struct timer_struct * timer);
+
+/* Join the slot barrier, also allowed while the timer runs (see timer.c) */
+struct timer_id_t * attach_event(struct timer_struct * timer);
 
 void detach_event(struct timer_id_t * event);
 
 void next_slot(struct timer_id_t* timer_id);
 
-uint64_t current_time();
+/* Same as next_slot for a device that had nothing to do in this slot.
+ * If every device of a slot is idle or asleep, the timer jumps straight
+ * to the earliest wakeup (see TIMER_FASTFWD). */
+void idle_slot(struct timer_id_t* timer_id);
+
+/* idle_slot for a device that stays on the barrier but knows it has
+ * nothing to do before [time]: the timer may jump there like it does for
+ * sleepers */
+void idle_until(struct timer_id_t* timer_id, uint64_t time);
+
+/* Leave the barrier and come back when current_time() reaches [time] */
+void sleep_until(struct timer_id_t* timer_id, uint64_t time);
+
+/* sleep_until for a device that did some work in this slot, and the work
+ * of the slots up to [time] with it: this slot still counts as busy */
+void busy_until(struct timer_id_t* timer_id, uint64_t time);
+
+/* Leave the barrier until another device calls unpark_event. The caller
+ * sets itself up with park_prepare before it becomes visible to the
+ * devices that may wake it. */
+void park_prepare(struct timer_id_t* timer_id);
+void park_event(struct timer_id_t* timer_id);
+
+/* Bring a parked device back, it takes part in the current slot. Same
+ * rule as attach_event: only from a device that has not arrived yet. */
+void unpark_event(struct timer_id_t* timer_id);
+
+/* Advance the clock to [time] without going through the slot barrier,
+ * used when a single thread drives every device */
+void step_timer(struct timer_struct * timer, uint64_t time);
+
+uint64_t current_time(struct timer_struct * timer);
 
 #endif
@@ -0,0 +1,138 @@
+/*
+ * Batch runner
+ *  Run many simulations inside one host process. Every configure file
+ *  given on the command line is one job; a pool of worker threads takes
+ *  the jobs in order and runs each of them in its own sim_ctx, writing the
+ *  trace to [output dir]/[config name].output.
+ *
+ *  Usage: batch [-j jobs] [-o output dir] [-t] [-q] [-m] config...
+ *    -j  number of worker threads (default: number of online CPUs)
+ *    -o  where the traces go (default: output/batch)
+ *    -t  run each simulation with one host thread per device instead of
+ *        the single-threaded engine
+ *    -q  run each simulation in slice mode (see sim_ctx.slice_mode)
+ *    -m  also write the scheduling metrics of each run to
+ *        [output dir]/[config name].json
+ */
+
+#include "sim.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char **configs;
+static int num_configs;
+static const char *out_dir = "output/batch";
+static int threaded = 0;
+static int slice_mode = 0;
+static int metrics = 0;
+
+/* Index of the next job to hand out */
+static int next_job = 0;
+static int failed = 0;
+
+static int run_job(const char *config) {
+  char path[256];
+  char out_path[256];
+  const char *name = strrchr(config, '/');
+  name = name ? name + 1 : config;
+
+  snprintf(path, sizeof(path), "input/%s", config);
+  snprintf(out_path, sizeof(out_path), "%s/%s.output", out_dir, name);
+
+  FILE *out = fopen(out_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot open output file %s\n", out_path);
+    return -1;
+  }
+
+  struct sim_ctx *ctx = (struct sim_ctx *)aligned_alloc(
+      CACHE_LINE_SIZE, sizeof(struct sim_ctx));
+  int ret = sim_init(ctx, path, out);
+  if (ret == 0) {
+    ctx->sequential = !threaded;
+    ctx->slice_mode = slice_mode;
+    sim_run(ctx);
+    if (metrics) {
+      snprintf(out_path, sizeof(out_path), "%s/%s.json", out_dir, name);
+      ret = stats_write(ctx, out_path);
+    }
+    sim_destroy(ctx);
+  }
+  free(ctx);
+  fclose(out);
+  return ret;
+}
+
+static void *worker_routine(void *args) {
+  int i;
+  while ((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) <
+         num_configs) {
+    if (run_job(configs[i]) < 0) {
+      fprintf(stderr, "%s: failed\n", configs[i]);
+      __atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+    } else {
+      fprintf(stderr, "%s: done\n", configs[i]);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while ((opt = getopt(argc, argv, "j:o:tqm")) != -1) {
+    switch (opt) {
+    case 'j':
+      num_workers = atoi(optarg);
+      break;
+    case 'o':
+      out_dir = optarg;
+      break;
+    case 't':
+      threaded = 1;
+      break;
+    case 'q':
+      slice_mode = 1;
+      break;
+    case 'm':
+      metrics = 1;
+      break;
+    default:
+      printf("Usage: batch [-j jobs] [-o output dir] [-t] [-q] [-m] "
+             "config...\n");
+      return 1;
+    }
+  }
+  if (optind == argc) {
+    printf("Usage: batch [-j jobs] [-o output dir] [-t] [-q] [-m] config...\n");
+    return 1;
+  }
+  configs = &argv[optind];
+  num_configs = argc - optind;
+  if (num_workers < 1)
+    num_workers = 1;
+  if (num_workers > num_configs)
+    num_workers = num_configs;
+
+  if (mkdir(out_dir, 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "Cannot create output directory %s\n", out_dir);
+    return 1;
+  }
+
+  pthread_t *workers = (pthread_t *)malloc(num_workers * sizeof(pthread_t));
+  int i;
+  for (i = 0; i < num_workers; i++)
+    pthread_create(&workers[i], NULL, worker_routine, NULL);
+  for (i = 0; i < num_workers; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+
+  return failed;
+}
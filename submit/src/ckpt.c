@@ -0,0 +1,626 @@
+/*
+ * Checkpoint and restore
+ *  The writer walks every heap block reachable from the sim_ctx, gives each
+ *  one an index and records every pointer field as (holder object, field
+ *  offset) -> (target object, offset in target). The sim_ctx is object 0,
+ *  so pointers into it (pcb->ctx, pcb->mram, ...) need no special case.
+ *
+ *  File layout:
+ *    struct ckpt_header
+ *    struct ckpt_obj    [nobjs]
+ *    struct ckpt_reloc  [nrelocs]
+ *    object data, 16 byte aligned, MEMPHY storage page aligned
+ */
+
+#include "ckpt.h"
+#include "mm.h"
+#include "sched.h"
+#include "sim.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CKPT_MAGIC "OSSIMCK1"
+#define CKPT_VERSION 6
+
+/* Object is mapped from the file on restore instead of copied */
+#define CKPT_OBJ_MAPPED 1
+/* Object is copied to a cache line aligned block on restore */
+#define CKPT_OBJ_ALIGNED 2
+
+#define CKPT_NONE UINT32_MAX
+#define CKPT_PAGE 4096
+
+struct ckpt_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t nobjs;
+  uint32_t nrelocs;
+  uint32_t pad;
+  /* A snapshot is only valid for the build that wrote it */
+  uint64_t layout[6];
+  uint64_t time;
+  uint64_t file_size;
+};
+
+struct ckpt_obj {
+  uint64_t off;
+  uint64_t size;
+  uint32_t flags;
+  uint32_t pad;
+};
+
+struct ckpt_reloc {
+  uint32_t holder;
+  uint32_t target; /* CKPT_NONE stores NULL */
+  uint64_t field;
+  uint64_t inner;
+};
+
+/* Object and relocation tables being built by the writer */
+struct ckpt_writer {
+  struct sim_ctx *ctx;
+
+  struct {
+    const void *ptr;
+    uint64_t size;
+    uint32_t flags;
+  } *objs;
+  uint32_t nobjs;
+  uint32_t objs_cap;
+
+  /* Open addressing on the object address, holds index + 1 */
+  uint32_t *hash;
+  uint32_t hash_cap;
+
+  /* Targets are resolved once every object is known */
+  struct {
+    uint32_t holder;
+    uint64_t field;
+    const void *target;
+  } *relocs;
+  uint32_t nrelocs;
+  uint32_t relocs_cap;
+};
+
+static void layout(uint64_t *l) {
+  l[0] = sizeof(struct sim_ctx);
+  l[1] = sizeof(struct pcb_t);
+  l[2] = sizeof(struct mm_struct);
+  l[3] = sizeof(struct framephy_struct);
+  l[4] = PAGING_MAX_PGN;
+  l[5] = MAX_PRIO;
+}
+
+static uint32_t ckpt_hash_slot(struct ckpt_writer *w, const void *ptr) {
+  uintptr_t h = (uintptr_t)ptr;
+  h ^= h >> 17;
+  h *= 0x9e3779b97f4a7c15ULL;
+  uint32_t i = (uint32_t)(h >> 32) & (w->hash_cap - 1);
+  while (w->hash[i] != 0 && w->objs[w->hash[i] - 1].ptr != ptr)
+    i = (i + 1) & (w->hash_cap - 1);
+  return i;
+}
+
+static uint32_t ckpt_find(struct ckpt_writer *w, const void *ptr) {
+  uint32_t i = ckpt_hash_slot(w, ptr);
+  return w->hash[i] ? w->hash[i] - 1 : CKPT_NONE;
+}
+
+static uint32_t ckpt_add(struct ckpt_writer *w, const void *ptr, uint64_t size,
+                         uint32_t flags) {
+  if (2 * (w->nobjs + 1) > w->hash_cap) {
+    uint32_t *old = w->hash;
+    uint32_t old_cap = w->hash_cap;
+    w->hash_cap = old_cap ? 2 * old_cap : 1024;
+    w->hash = calloc(w->hash_cap, sizeof(uint32_t));
+    uint32_t i;
+    for (i = 0; i < old_cap; i++) {
+      if (old[i] != 0)
+        w->hash[ckpt_hash_slot(w, w->objs[old[i] - 1].ptr)] = old[i];
+    }
+    free(old);
+  }
+  if (w->nobjs == w->objs_cap) {
+    w->objs_cap = w->objs_cap ? 2 * w->objs_cap : 1024;
+    w->objs = realloc(w->objs, w->objs_cap * sizeof(*w->objs));
+  }
+  uint32_t idx = w->nobjs++;
+  w->objs[idx].ptr = ptr;
+  w->objs[idx].size = size;
+  w->objs[idx].flags = flags;
+  w->hash[ckpt_hash_slot(w, ptr)] = idx + 1;
+  return idx;
+}
+
+/* Record the pointer stored at [field], a member of object [holder] */
+static void ckpt_ptr(struct ckpt_writer *w, uint32_t holder,
+                     const void *field) {
+  const void *target = *(void *const *)field;
+  if (target == NULL)
+    return;
+  if (w->nrelocs == w->relocs_cap) {
+    w->relocs_cap = w->relocs_cap ? 2 * w->relocs_cap : 1024;
+    w->relocs = realloc(w->relocs, w->relocs_cap * sizeof(*w->relocs));
+  }
+  w->relocs[w->nrelocs].holder = holder;
+  w->relocs[w->nrelocs].field =
+      (const char *)field - (const char *)w->objs[holder].ptr;
+  w->relocs[w->nrelocs].target = target;
+  w->nrelocs++;
+}
+
+static void save_rg_list(struct ckpt_writer *w, struct vm_rg_struct *rg) {
+  while (rg != NULL && ckpt_find(w, rg) == CKPT_NONE) {
+    uint32_t idx = ckpt_add(w, rg, sizeof(*rg), 0);
+    ckpt_ptr(w, idx, &rg->rg_next);
+    rg = rg->rg_next;
+  }
+}
+
+static void save_mm(struct ckpt_writer *w, struct mm_struct *mm) {
+  if (mm == NULL || ckpt_find(w, mm) != CKPT_NONE)
+    return;
+  uint32_t idx = ckpt_add(w, mm, sizeof(*mm), 0);
+
+  ckpt_ptr(w, idx, &mm->pgd);
+  if (mm->pgd != NULL)
+    ckpt_add(w, mm->pgd, PAGING_MAX_PGN * sizeof(uint32_t), 0);
+
+  ckpt_ptr(w, idx, &mm->mmap);
+  struct vm_area_struct *vma;
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next) {
+    uint32_t vidx = ckpt_add(w, vma, sizeof(*vma), 0);
+    ckpt_ptr(w, vidx, &vma->vm_mm);
+    ckpt_ptr(w, vidx, &vma->vm_freerg_list);
+    ckpt_ptr(w, vidx, &vma->vm_next);
+    save_rg_list(w, vma->vm_freerg_list);
+  }
+
+  int i;
+  for (i = 0; i < PAGING_MAX_SYMTBL_SZ; i++) {
+    ckpt_ptr(w, idx, &mm->symrgtbl[i].rg_next);
+    save_rg_list(w, mm->symrgtbl[i].rg_next);
+  }
+
+  ckpt_ptr(w, idx, &mm->fifo_pgn);
+  struct pgn_t *pg;
+  for (pg = mm->fifo_pgn; pg != NULL; pg = pg->pg_next) {
+    uint32_t pidx = ckpt_add(w, pg, sizeof(*pg), 0);
+    ckpt_ptr(w, pidx, &pg->pg_next);
+  }
+}
+
+static void save_pcb(struct ckpt_writer *w, struct pcb_t *proc) {
+  if (proc == NULL || ckpt_find(w, proc) != CKPT_NONE)
+    return;
+  uint32_t idx = ckpt_add(w, proc, sizeof(*proc), 0);
+  ckpt_ptr(w, idx, &proc->ctx);
+  /* The rest of its tree is reached through the rq, or from here */
+  ckpt_ptr(w, idx, &proc->rb_parent);
+  ckpt_ptr(w, idx, &proc->rb_left);
+  ckpt_ptr(w, idx, &proc->rb_right);
+  save_pcb(w, proc->rb_left);
+  save_pcb(w, proc->rb_right);
+
+  /* Threads of a process share its code and memory */
+  ckpt_ptr(w, idx, &proc->parent);
+  save_pcb(w, proc->parent);
+  ckpt_ptr(w, idx, &proc->join_prev);
+  ckpt_ptr(w, idx, &proc->join_next);
+  save_pcb(w, proc->join_next);
+  ckpt_ptr(w, idx, &proc->code);
+  if (ckpt_find(w, proc->code) == CKPT_NONE) {
+    uint32_t cidx = ckpt_add(w, proc->code, sizeof(struct code_seg_t), 0);
+    ckpt_ptr(w, cidx, &proc->code->text);
+    /* Not saved, run() decodes the text again */
+    ckpt_ptr(w, cidx, &proc->code->ops);
+    ckpt_add(w, proc->code->text, proc->code->size * sizeof(struct inst_t),
+             0);
+  }
+
+  ckpt_ptr(w, idx, &proc->page_table);
+  if (proc->page_table != NULL &&
+      ckpt_find(w, proc->page_table) == CKPT_NONE) {
+    struct page_table_t *pt = proc->page_table;
+    uint32_t tidx = ckpt_add(w, pt, sizeof(*pt), 0);
+    int i;
+    for (i = 0; i < pt->size && i < (1 << FIRST_LV_LEN); i++) {
+      ckpt_ptr(w, tidx, &pt->table[i].next_lv);
+      if (pt->table[i].next_lv != NULL &&
+          ckpt_find(w, pt->table[i].next_lv) == CKPT_NONE)
+        ckpt_add(w, pt->table[i].next_lv, sizeof(struct trans_table_t), 0);
+    }
+  }
+
+#ifdef MM_PAGING
+  ckpt_ptr(w, idx, &proc->mm);
+  ckpt_ptr(w, idx, &proc->mram);
+  ckpt_ptr(w, idx, &proc->mswp);
+  ckpt_ptr(w, idx, &proc->active_mswp);
+  save_mm(w, proc->mm);
+#endif
+}
+
+/* Only the live part of the ring points anywhere, dequeue clears the
+ * rest */
+static void save_queue(struct ckpt_writer *w, uint32_t holder,
+                       struct queue_t *q) {
+  ckpt_ptr(w, holder, &q->proc);
+  if (q->proc == NULL)
+    return;
+  uint32_t idx = ckpt_add(w, q->proc, q->cap * sizeof(struct pcb_t *), 0);
+  int i;
+  for (i = 0; i < q->size; i++) {
+    struct pcb_t **slot = &q->proc[(q->head + i) % q->cap];
+    ckpt_ptr(w, idx, slot);
+    save_pcb(w, *slot);
+  }
+}
+
+#ifdef MM_PAGING
+static void save_fp_list(struct ckpt_writer *w, struct framephy_struct *fp) {
+  for (; fp != NULL; fp = fp->fp_next) {
+    uint32_t idx = ckpt_add(w, fp, sizeof(*fp), 0);
+    ckpt_ptr(w, idx, &fp->fp_next);
+    /* The owner may have finished already, its mm is still around */
+    ckpt_ptr(w, idx, &fp->owner);
+    ckpt_ptr(w, idx, &fp->mapping_process);
+    save_mm(w, fp->owner);
+  }
+}
+
+static void save_memphy(struct ckpt_writer *w, struct memphy_struct *mp) {
+  ckpt_ptr(w, 0, &mp->storage);
+  if (mp->storage != NULL)
+    ckpt_add(w, mp->storage, mp->maxsz, mp->maxsz ? CKPT_OBJ_MAPPED : 0);
+  ckpt_ptr(w, 0, &mp->free_fp_list);
+  ckpt_ptr(w, 0, &mp->used_fp_list);
+  save_fp_list(w, mp->free_fp_list);
+  save_fp_list(w, mp->used_fp_list);
+}
+#endif
+
+static void save_ctx(struct ckpt_writer *w, struct sim_ctx *ctx) {
+  struct ld_args *ld_processes = &ctx->ld_processes;
+  int i;
+
+  ckpt_add(w, ctx, sizeof(*ctx), 0);
+
+  /* Configuration */
+  ckpt_ptr(w, 0, &ld_processes->path);
+  uint32_t pidx = ckpt_add(w, ld_processes->path,
+                           ctx->num_processes * sizeof(char *), 0);
+  for (i = 0; i < ctx->num_processes; i++) {
+    ckpt_ptr(w, pidx, &ld_processes->path[i]);
+    ckpt_add(w, ld_processes->path[i], strlen(ld_processes->path[i]) + 1, 0);
+  }
+  ckpt_ptr(w, 0, &ld_processes->start_time);
+  ckpt_add(w, ld_processes->start_time,
+           ctx->num_processes * sizeof(unsigned long), 0);
+#ifdef MLQ_SCHED
+  ckpt_ptr(w, 0, &ld_processes->prio);
+  ckpt_add(w, ld_processes->prio, ctx->num_processes * sizeof(unsigned long),
+           0);
+#endif
+  ckpt_ptr(w, 0, &ld_processes->deadline);
+  ckpt_add(w, ld_processes->deadline,
+           ctx->num_processes * sizeof(unsigned long), 0);
+  ckpt_ptr(w, 0, &ld_processes->period);
+  ckpt_add(w, ld_processes->period, ctx->num_processes * sizeof(unsigned long),
+           0);
+  ckpt_ptr(w, 0, &ld_processes->group);
+  ckpt_add(w, ld_processes->group, ctx->num_processes * sizeof(int), 0);
+  ckpt_ptr(w, 0, &ctx->hotplug);
+  if (ctx->hotplug != NULL)
+    ckpt_add(w, ctx->hotplug, ctx->num_hotplug * sizeof(struct hotplug_event),
+             0);
+
+  /* Devices */
+  ckpt_ptr(w, 0, &ctx->ld.ctx);
+  ckpt_ptr(w, 0, &ctx->ioc.ctx);
+  ckpt_ptr(w, 0, &ctx->cpus);
+  uint32_t cidx =
+      ckpt_add(w, ctx->cpus, ctx->max_cpus * sizeof(struct cpu_args),
+               CKPT_OBJ_ALIGNED);
+  for (i = 0; i < ctx->max_cpus; i++) {
+    ckpt_ptr(w, cidx, &ctx->cpus[i].ctx);
+    ckpt_ptr(w, cidx, &ctx->cpus[i].proc);
+    save_pcb(w, ctx->cpus[i].proc);
+  }
+
+  /* Metrics */
+  ckpt_ptr(w, 0, &ctx->finished);
+  ckpt_add(w, ctx->finished, ctx->finished_cap * sizeof(struct proc_stats),
+           0);
+
+  /* Scheduler */
+  ckpt_ptr(w, 0, &ctx->sched.parked);
+  ckpt_add(w, ctx->sched.parked, ctx->max_cpus * sizeof(int), 0);
+  ckpt_ptr(w, 0, &ctx->sched.rq);
+  uint32_t ridx =
+      ckpt_add(w, ctx->sched.rq, ctx->max_cpus * sizeof(struct cpu_rq),
+               CKPT_OBJ_ALIGNED);
+  for (i = 0; i < ctx->max_cpus; i++) {
+    struct cpu_rq *rq = &ctx->sched.rq[i];
+    save_queue(w, ridx, &rq->fifo_queue);
+    int prio;
+    for (prio = 0; prio < MAX_PRIO; prio++)
+      save_queue(w, ridx, &rq->mlq_ready_queue[prio]);
+    ckpt_ptr(w, ridx, &rq->vt_tree.root);
+    ckpt_ptr(w, ridx, &rq->vt_tree.leftmost);
+    save_pcb(w, rq->vt_tree.root);
+    int g;
+    for (g = 0; g < GROUP_MAX; g++) {
+      ckpt_ptr(w, ridx, &rq->grp[g].tree.root);
+      ckpt_ptr(w, ridx, &rq->grp[g].tree.leftmost);
+      save_pcb(w, rq->grp[g].tree.root);
+    }
+    ckpt_ptr(w, ridx, &rq->groups);
+    ckpt_ptr(w, ridx, &rq->dl_heap);
+    if (rq->dl_heap != NULL) {
+      uint32_t didx =
+          ckpt_add(w, rq->dl_heap, rq->dl_cap * sizeof(struct pcb_t *), 0);
+      int j;
+      for (j = 0; j < rq->dl_size; j++) {
+        ckpt_ptr(w, didx, &rq->dl_heap[j]);
+        save_pcb(w, rq->dl_heap[j]);
+      }
+    }
+    ckpt_ptr(w, ridx, &rq->lot_procs);
+    ckpt_ptr(w, ridx, &rq->lot_tickets);
+    if (rq->lot_procs != NULL) {
+      uint32_t lidx =
+          ckpt_add(w, rq->lot_procs, rq->lot_cap * sizeof(struct pcb_t *), 0);
+      int j;
+      for (j = 0; j < rq->lot_nr; j++) {
+        ckpt_ptr(w, lidx, &rq->lot_procs[j]);
+        save_pcb(w, rq->lot_procs[j]);
+      }
+      ckpt_add(w, rq->lot_tickets, rq->lot_cap * sizeof(uint64_t), 0);
+    }
+  }
+
+  /* Sync objects, their waiters are out of every run queue, and so are
+   * the processes waiting for their threads */
+  for (i = 0; i < ctx->nr_sync; i++)
+    save_queue(w, 0, &ctx->sync[i].waiters);
+  ckpt_ptr(w, 0, &ctx->joiners);
+  save_pcb(w, ctx->joiners);
+
+  /* I/O requests in flight, their processes are out of every queue too */
+  ckpt_ptr(w, 0, &ctx->io_reqs);
+  if (ctx->io_reqs != NULL) {
+    uint32_t qidx =
+        ckpt_add(w, ctx->io_reqs, ctx->io_cap * sizeof(struct io_req), 0);
+    for (i = 0; i < ctx->io_nreq; i++) {
+      ckpt_ptr(w, qidx, &ctx->io_reqs[i].proc);
+      save_pcb(w, ctx->io_reqs[i].proc);
+    }
+  }
+
+#ifdef MM_PAGING
+  save_memphy(w, &ctx->mram);
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+    save_memphy(w, &ctx->mswp[i]);
+#endif
+}
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+static int write_pad(FILE *file, uint64_t *pos, uint64_t to) {
+  static const char zero[CKPT_PAGE];
+  while (*pos < to) {
+    uint64_t n = to - *pos < CKPT_PAGE ? to - *pos : CKPT_PAGE;
+    if (fwrite(zero, 1, n, file) != n)
+      return -1;
+    *pos += n;
+  }
+  return 0;
+}
+
+int ckpt_save(struct sim_ctx *ctx, const char *path) {
+  struct ckpt_writer w;
+  memset(&w, 0, sizeof(w));
+  w.ctx = ctx;
+  save_ctx(&w, ctx);
+
+  struct ckpt_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic));
+  hdr.version = CKPT_VERSION;
+  hdr.nobjs = w.nobjs;
+  hdr.nrelocs = w.nrelocs;
+  layout(hdr.layout);
+  hdr.time = current_time(&ctx->timer);
+
+  /* Place every object */
+  struct ckpt_obj *objs = calloc(w.nobjs, sizeof(struct ckpt_obj));
+  uint64_t pos = sizeof(hdr) + w.nobjs * sizeof(struct ckpt_obj) +
+                 w.nrelocs * sizeof(struct ckpt_reloc);
+  uint32_t i;
+  for (i = 0; i < w.nobjs; i++) {
+    pos = align_up(pos, w.objs[i].flags & CKPT_OBJ_MAPPED ? CKPT_PAGE : 16);
+    objs[i].off = pos;
+    objs[i].size = w.objs[i].size;
+    objs[i].flags = w.objs[i].flags;
+    pos += w.objs[i].size;
+  }
+  hdr.file_size = pos;
+
+  /* Resolve pointer targets */
+  struct ckpt_reloc *relocs = calloc(w.nrelocs, sizeof(struct ckpt_reloc));
+  for (i = 0; i < w.nrelocs; i++) {
+    const char *target = w.relocs[i].target;
+    relocs[i].holder = w.relocs[i].holder;
+    relocs[i].field = w.relocs[i].field;
+    if (target >= (const char *)ctx && target < (const char *)(ctx + 1)) {
+      relocs[i].target = 0;
+      relocs[i].inner = target - (const char *)ctx;
+    } else {
+      /* Unknown targets (e.g. a finished process) come back as NULL */
+      relocs[i].target = ckpt_find(&w, target);
+      relocs[i].inner = 0;
+    }
+  }
+
+  int ret = -1;
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot write checkpoint to %s\n", path);
+    goto out;
+  }
+  pos = 0;
+  if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+      fwrite(objs, sizeof(struct ckpt_obj), w.nobjs, file) != w.nobjs ||
+      fwrite(relocs, sizeof(struct ckpt_reloc), w.nrelocs, file) !=
+          w.nrelocs)
+    goto close;
+  pos = sizeof(hdr) + w.nobjs * sizeof(struct ckpt_obj) +
+        w.nrelocs * sizeof(struct ckpt_reloc);
+  for (i = 0; i < w.nobjs; i++) {
+    if (write_pad(file, &pos, objs[i].off) < 0 ||
+        fwrite(w.objs[i].ptr, 1, objs[i].size, file) != objs[i].size)
+      goto close;
+    pos += objs[i].size;
+  }
+  ret = 0;
+
+close:
+  if (fclose(file) != 0 || ret < 0) {
+    fprintf(stderr, "Cannot write checkpoint to %s\n", path);
+    ret = -1;
+  }
+out:
+  free(relocs);
+  free(objs);
+  free(w.objs);
+  free(w.hash);
+  free(w.relocs);
+  return ret;
+}
+
+int ckpt_restore(struct sim_ctx *ctx, const char *path, FILE *out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(out, "Cannot find checkpoint at %s\n", path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(struct ckpt_header)) {
+    close(fd);
+    fprintf(out, "%s is not a checkpoint\n", path);
+    return -1;
+  }
+  char *base =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(out, "Cannot map checkpoint %s\n", path);
+    return -1;
+  }
+
+  /* Check that the snapshot fits this build */
+  struct ckpt_header *hdr = (struct ckpt_header *)base;
+  uint64_t l[6];
+  layout(l);
+  struct ckpt_obj *objs = (struct ckpt_obj *)(hdr + 1);
+  struct ckpt_reloc *relocs = (struct ckpt_reloc *)(objs + hdr->nobjs);
+  if (memcmp(hdr->magic, CKPT_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != CKPT_VERSION || memcmp(hdr->layout, l, sizeof(l)) != 0 ||
+      hdr->file_size != (uint64_t)st.st_size || hdr->nobjs == 0 ||
+      (char *)(relocs + hdr->nrelocs) > base + st.st_size ||
+      objs[0].size != sizeof(struct sim_ctx))
+    goto bad;
+
+  uint32_t i;
+  for (i = 0; i < hdr->nobjs; i++) {
+    if (objs[i].off > hdr->file_size ||
+        objs[i].size > hdr->file_size - objs[i].off)
+      goto bad;
+  }
+  for (i = 0; i < hdr->nrelocs; i++) {
+    struct ckpt_reloc *r = &relocs[i];
+    if (r->holder >= hdr->nobjs ||
+        r->field + sizeof(void *) > objs[r->holder].size ||
+        (r->target != CKPT_NONE &&
+         (r->target >= hdr->nobjs || r->inner > objs[r->target].size)))
+      goto bad;
+  }
+
+  /* Storage stays in the mapping, everything else moves to the heap so
+   * the simulation can free it as usual */
+  char **addr = malloc(hdr->nobjs * sizeof(char *));
+  memcpy(ctx, base + objs[0].off, sizeof(struct sim_ctx));
+  addr[0] = (char *)ctx;
+  for (i = 1; i < hdr->nobjs; i++) {
+    if (objs[i].flags & CKPT_OBJ_MAPPED) {
+      addr[i] = base + objs[i].off;
+    } else if (objs[i].flags & CKPT_OBJ_ALIGNED) {
+      addr[i] = aligned_alloc(CACHE_LINE_SIZE,
+                              align_up(objs[i].size ? objs[i].size : 1,
+                                       CACHE_LINE_SIZE));
+      memcpy(addr[i], base + objs[i].off, objs[i].size);
+    } else {
+      addr[i] = malloc(objs[i].size ? objs[i].size : 1);
+      memcpy(addr[i], base + objs[i].off, objs[i].size);
+    }
+  }
+  for (i = 0; i < hdr->nrelocs; i++) {
+    struct ckpt_reloc *r = &relocs[i];
+    char *target = r->target == CKPT_NONE ? NULL : addr[r->target] + r->inner;
+    memcpy(addr[r->holder] + r->field, &target, sizeof(target));
+  }
+  free(addr);
+
+  /* Host resources are not part of the snapshot */
+  uint64_t time = hdr->time;
+  ctx->out = out;
+  ctx->ckpt_path = NULL;
+  ctx->ckpt_map = base;
+  ctx->ckpt_size = st.st_size;
+  pthread_mutex_init(&ctx->vm_lock, NULL);
+  pthread_mutex_init(&ctx->sched.queue_lock, NULL);
+  for (i = 0; i < (uint32_t)ctx->max_cpus; i++)
+    pthread_mutex_init(&ctx->sched.rq[i].lock, NULL);
+  for (i = 0; i < (uint32_t)ctx->nr_sync; i++)
+    pthread_mutex_init(&ctx->sync[i].lock, NULL);
+  for (i = 0; i < (uint32_t)ctx->nr_groups; i++)
+    pthread_mutex_init(&ctx->groups[i].lock, NULL);
+  pthread_mutex_init(&ctx->io_lock, NULL);
+  pthread_mutex_init(&ctx->thread_lock, NULL);
+  pthread_mutex_init(&ctx->stats_lock, NULL);
+  init_timer(&ctx->timer, out);
+  ctx->timer.time = time;
+  for (i = 0; i < (uint32_t)ctx->max_cpus; i++) {
+    ctx->cpus[i].timer_id = NULL;
+    ctx->cpus[i].has_thread = 0;
+  }
+  ctx->ld.timer_id = NULL;
+  ctx->ioc.timer_id = NULL;
+  return 0;
+
+bad:
+  munmap(base, st.st_size);
+  fprintf(out, "%s is not a checkpoint of this simulator\n", path);
+  return -1;
+}
+
+int ckpt_mapped(struct sim_ctx *ctx, const void *ptr) {
+  const char *p = ptr;
+  return ctx->ckpt_map != NULL && p >= (const char *)ctx->ckpt_map &&
+         p < (const char *)ctx->ckpt_map + ctx->ckpt_size;
+}
+
+void ckpt_unmap(struct sim_ctx *ctx) {
+  if (ctx->ckpt_map != NULL)
+    munmap(ctx->ckpt_map, ctx->ckpt_size);
+  ctx->ckpt_map = NULL;
+}
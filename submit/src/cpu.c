@@ -2,7 +2,12 @@
 #include "cpu.h"
 #include "mem.h"
 #include "mm.h"
+#include "sim.h"
 #include "stdio.h"
+#include "sync.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
 
 int calc(struct pcb_t *proc) { return ((unsigned long)proc & 0UL); }
 
@@ -42,65 +47,263 @@ int write(struct pcb_t *proc,   // Process executing the instruction
   return write_mem(proc->regs[destination] + offset, proc, data);
 }
 
-int run(struct pcb_t *proc) {
-  /* Check if Program Counter point to the proper instruction */
-  if (proc->pc >= proc->code->size) {
-    return 1;
+int copy(struct pcb_t *proc,   // Process executing the instruction
+         uint32_t source,      // Index of source register
+         uint32_t srcoff,      // Source address = [source] + [srcoff]
+         uint32_t destination, // Index of destination register
+         uint32_t dstoff,      // Destination address =
+         uint32_t len) {       // [destination] + [dstoff]
+  addr_t from = proc->regs[source] + srcoff;
+  addr_t to = proc->regs[destination] + dstoff;
+  /* Backwards when the destination overlaps the end of the source */
+  int back = to > from && to < from + len;
+  uint32_t i;
+  for (i = 0; i < len; i++) {
+    uint32_t k = back ? len - 1 - i : i;
+    BYTE data;
+    if (read_mem(from + k, proc, &data) || write_mem(to + k, proc, data))
+      return 1;
   }
+  return 0;
+}
 
-  struct inst_t ins = proc->code->text[proc->pc];
-  proc->pc++;
-  int stat = 1;
-  switch (ins.opcode) {
-  case CALC:
-    stat = calc(proc);
-    break;
-  case ALLOC:
+int fill(struct pcb_t *proc,   // Process executing the instruction
+         uint32_t destination, // Index of destination register
+         uint32_t offset,      // First address = [destination] + [offset]
+         uint32_t len,         // Number of bytes
+         BYTE data) {          // Value written to each of them
+  uint32_t i;
+  for (i = 0; i < len; i++) {
+    if (write_mem(proc->regs[destination] + offset + i, proc, data))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * The memory instructions, [arg] their operands. Kept out of run(), which
+ * would otherwise set up the frame their calls need for every calc too
+ */
+static __attribute__((noinline)) int run_alloc(struct pcb_t *proc,
+                                               const uint32_t *arg) {
 #ifdef MM_PAGING
-    printf("*=======================\n");
-    stat = pgalloc(proc, ins.arg_0, ins.arg_1);
-    printf("process %d alloc region %d size %d\n\n", proc->pid, ins.arg_1,
-           ins.arg_0);
-    print_pgtbl(proc, 0, -1);
-    printf("=======================*\n");
+  fprintf(proc->ctx->out, "*=======================\n");
+  int stat = pgalloc(proc, arg[0], arg[1]);
+  fprintf(proc->ctx->out, "process %d alloc region %d size %d\n\n",
+          proc->pid, arg[1], arg[0]);
+  print_pgtbl(proc, 0, -1);
+  fprintf(proc->ctx->out, "=======================*\n");
 #ifdef MEMPHYS_DUMP
-    MEMPHY_dump(proc->mram);
+  MEMPHY_dump(proc->mram, proc->ctx->out);
 #endif
+  return stat;
+#else
+  return alloc(proc, arg[0], arg[1]);
+#endif
+}
 
+static __attribute__((noinline)) int run_free(struct pcb_t *proc,
+                                              const uint32_t *arg) {
+#ifdef MM_PAGING
+  fprintf(proc->ctx->out, "*=======================\n");
+  int stat = pgfree_data(proc, arg[0]);
+  fprintf(proc->ctx->out, "process %d free region %d\n\n", proc->pid,
+          arg[0]);
+  fprintf(proc->ctx->out, "=======================*\n");
+  return stat;
 #else
-    stat = alloc(proc, ins.arg_0, ins.arg_1);
+  return free_data(proc, arg[0]);
 #endif
-    break;
-  case FREE:
+}
+
+static __attribute__((noinline)) int run_read(struct pcb_t *proc,
+                                              const uint32_t *arg) {
 #ifdef MM_PAGING
-    printf("*=======================\n");
-    stat = pgfree_data(proc, ins.arg_0);
-    printf("process %d free region %d\n\n", proc->pid, ins.arg_0);
-    printf("=======================*\n");
+  fprintf(proc->ctx->out, "*=======================\n");
+  int stat = pgread(proc, arg[0], arg[1], arg[2]);
+  fprintf(proc->ctx->out, "=======================*\n");
+  return stat;
 #else
-    stat = free_data(proc, ins.arg_0);
+  return read(proc, arg[0], arg[1], arg[2]);
 #endif
-    break;
-  case READ:
+}
+
+static __attribute__((noinline)) int run_write(struct pcb_t *proc,
+                                               const uint32_t *arg) {
 #ifdef MM_PAGING
-    printf("*=======================\n");
-    stat = pgread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
-    printf("=======================*\n");
+  fprintf(proc->ctx->out, "*=======================\n");
+  int stat = pgwrite(proc, arg[0], arg[1], arg[2]);
+  fprintf(proc->ctx->out, "=======================*\n");
+  return stat;
 #else
-    stat = read(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+  return write(proc, arg[0], arg[1], arg[2]);
 #endif
-    break;
-  case WRITE:
+}
+
+static __attribute__((noinline)) int run_copy(struct pcb_t *proc,
+                                              const uint32_t *arg) {
 #ifdef MM_PAGING
-    printf("*=======================\n");
-    stat = pgwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
-    printf("=======================*\n");
+  fprintf(proc->ctx->out, "*=======================\n");
+  int stat = pgcopy(proc, arg[0], arg[1], arg[2], arg[3], arg[4]);
+  fprintf(proc->ctx->out, "=======================*\n");
+  return stat;
 #else
-    stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+  return copy(proc, arg[0], arg[1], arg[2], arg[3], arg[4]);
 #endif
-    break;
-  default:
-    stat = 1;
-  }
+}
+
+static __attribute__((noinline)) int run_fill(struct pcb_t *proc,
+                                              const uint32_t *arg) {
+#ifdef MM_PAGING
+  fprintf(proc->ctx->out, "*=======================\n");
+  int stat = pgfill(proc, arg[0], arg[1], arg[2], arg[3]);
+  fprintf(proc->ctx->out, "=======================*\n");
   return stat;
+#else
+  return fill(proc, arg[0], arg[1], arg[2], arg[3]);
+#endif
+}
+
+/* Operands of each opcode, in the operand pool of a decoded segment */
+static const uint8_t op_nargs[NR_OPCODES] = {
+    [ALLOC] = 2, [FREE] = 1,   [READ] = 3,   [WRITE] = 3, [LOCK] = 1,
+    [UNLOCK] = 1, [WAIT] = 1,  [SIGNAL] = 1, [IO] = 2,    [SPAWN] = 1,
+    [COPY] = 5,  [FILL] = 4,
+};
+
+/* The handlers of run() by opcode, for cpu_decode, which gets them with
+ * run(NULL) */
+static const void *const *op_handlers;
+
+/* Operand [k] of the instruction run() executes */
+#define ARG(k) (pool[op->arg + (k)])
+
+/*
+ * The interpreter
+ *  Direct-threaded: each decoded instruction holds the address of its
+ *  handler, so executing one is a jump through it rather than a copy of
+ *  the instruction and a switch on its opcode.
+ */
+int run(struct pcb_t *proc) {
+  static const void *const handlers[NR_OPCODES + 1] = {
+      [CALC] = &&op_calc,   [ALLOC] = &&op_alloc, [FREE] = &&op_free,
+      [READ] = &&op_read,   [WRITE] = &&op_write, [LOCK] = &&op_sync,
+      [UNLOCK] = &&op_sync, [WAIT] = &&op_sync,   [SIGNAL] = &&op_sync,
+      [IO] = &&op_io,       [SPAWN] = &&op_spawn, [JOIN] = &&op_join,
+      [COPY] = &&op_copy,   [FILL] = &&op_fill,   [NR_OPCODES] = &&op_bad,
+  };
+  if (proc == NULL) {
+    __atomic_store_n(&op_handlers, handlers, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  /* Check if Program Counter point to the proper instruction */
+  if (proc->pc >= proc->end) {
+    return 1;
+  }
+
+  /* Decoded at load, but not in a restored checkpoint */
+  const struct code_op *ops =
+      __atomic_load_n(&proc->code->ops, __ATOMIC_ACQUIRE);
+  if (ops == NULL) {
+    cpu_decode(proc->code);
+    ops = __atomic_load_n(&proc->code->ops, __ATOMIC_ACQUIRE);
+  }
+  const struct code_op *op = &ops[proc->pc];
+  /* The operand pool, op->arg is the first of its operands there */
+  const uint32_t *pool = (const uint32_t *)(ops + proc->code->size);
+  proc->pc++;
+  goto *op->handler;
+
+op_calc:
+  return calc(proc);
+
+op_alloc:
+  return run_alloc(proc, &ARG(0));
+
+op_free:
+  return run_free(proc, &ARG(0));
+
+op_read:
+  return run_read(proc, &ARG(0));
+
+op_write:
+  return run_write(proc, &ARG(0));
+
+op_copy:
+  return run_copy(proc, &ARG(0));
+
+op_fill:
+  return run_fill(proc, &ARG(0));
+
+op_sync:
+  return sync_run(proc, op->opcode, ARG(0));
+
+op_io:
+  /* Its CPU hands it to the device */
+  return RUN_BLOCKED;
+
+op_spawn:
+  return thread_spawn(proc, ARG(0));
+
+op_join:
+  return thread_join(proc);
+
+op_bad:
+  return 1;
+}
+
+#undef ARG
+
+void cpu_decode(struct code_seg_t *code) {
+  run(NULL);
+  const void *const *handlers =
+      __atomic_load_n(&op_handlers, __ATOMIC_RELAXED);
+
+  uint32_t nargs = 0, i;
+  for (i = 0; i < code->size; i++) {
+    if (code->text[i].opcode < NR_OPCODES)
+      nargs += op_nargs[code->text[i].opcode];
+  }
+  struct code_op *ops = (struct code_op *)malloc(
+      code->size * sizeof(struct code_op) + nargs * sizeof(uint32_t));
+  uint32_t *pool = (uint32_t *)(ops + code->size);
+
+  /* Backwards, so each calc knows the length of its run */
+  i = code->size;
+  while (i-- > 0) {
+    struct inst_t *ins = &code->text[i];
+    uint32_t opcode = ins->opcode < NR_OPCODES ? ins->opcode : NR_OPCODES;
+    ops[i].handler = handlers[opcode];
+    ops[i].opcode = opcode;
+    if (opcode == CALC) {
+      ops[i].arg = i + 1 < code->size && ops[i + 1].opcode == CALC
+                       ? ops[i + 1].arg + 1
+                       : 1;
+      continue;
+    }
+    uint32_t n = opcode < NR_OPCODES ? op_nargs[opcode] : 0;
+    nargs -= n;
+    ops[i].arg = nargs;
+    const uint32_t operands[] = {ins->arg_0, ins->arg_1, ins->arg_2,
+                                 ins->arg_3, ins->arg_4};
+    memcpy(&pool[nargs], operands, n * sizeof(uint32_t));
+  }
+
+  /* Threads of a restored process may race to do it */
+  struct code_op *none = NULL;
+  if (!__atomic_compare_exchange_n(&code->ops, &none, ops, 0, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_ACQUIRE))
+    free(ops);
+}
+
+uint32_t calc_run(struct pcb_t *proc) {
+  if (proc->pc >= proc->end)
+    return 0;
+  const struct code_op *op = &proc->code->ops[proc->pc];
+  if (op->opcode != CALC)
+    return 0;
+  /* A thread ends inside the text of its process */
+  uint32_t left = proc->end - proc->pc;
+  return op->arg < left ? op->arg : left;
 }
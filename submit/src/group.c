@@ -0,0 +1,88 @@
+
+#include "group.h"
+#include "sim.h"
+#include "timer.h"
+
+#include "os-cfg.h"
+#include <string.h>
+
+int group_lookup(struct sim_ctx *ctx, const char *name) {
+  int i;
+  for (i = 0; i < ctx->nr_groups; i++) {
+    if (strcmp(ctx->groups[i].name, name) == 0)
+      return i;
+  }
+  if (ctx->nr_groups == GROUP_MAX || strlen(name) >= GROUP_NAME_LEN)
+    return -1;
+
+  /* Only the configure file adds groups, before the run */
+  struct sched_group *grp = &ctx->groups[ctx->nr_groups];
+  memset(grp, 0, sizeof(*grp));
+  pthread_mutex_init(&grp->lock, NULL);
+  strcpy(grp->name, name);
+  grp->shares = GROUP_SHARES;
+  return ctx->nr_groups++;
+}
+
+/* Start the period [now] is in if the one of [grp] is over, grp lock
+ * held. Periods with nothing to run are skipped over */
+static void roll_period(struct sched_group *grp, uint64_t now) {
+  if (now < grp->period_start + grp->period)
+    return;
+  grp->period_start = now - (now - grp->period_start) % grp->period;
+  grp->used = 0;
+}
+
+int group_reserve(struct sim_ctx *ctx, struct pcb_t *proc, uint64_t *until) {
+  struct sched_group *grp = &ctx->groups[proc->group];
+  proc->quota_slots = 0;
+  if (grp->quota == 0)
+    return 1;
+
+  pthread_mutex_lock(&grp->lock);
+  roll_period(grp, current_time(&ctx->timer));
+  uint32_t left = grp->quota - grp->used;
+  if (left == 0) {
+    *until = grp->period_start + grp->period;
+    grp->throttled++;
+    pthread_mutex_unlock(&grp->lock);
+    return 0;
+  }
+  /* A time slot at most, the other CPUs may want some too */
+  uint32_t slots = left < (uint32_t)ctx->time_slot ? left : ctx->time_slot;
+  grp->used += slots;
+  proc->quota_slots = slots;
+  proc->quota_period = grp->period_start;
+  pthread_mutex_unlock(&grp->lock);
+  return 1;
+}
+
+void group_charge(struct sim_ctx *ctx, struct pcb_t *proc, uint64_t ran) {
+  struct sched_group *grp = &ctx->groups[proc->group];
+  __atomic_fetch_add(&grp->run, ran, __ATOMIC_RELAXED);
+  if (grp->quota == 0 || proc->quota_slots == 0)
+    return;
+
+  uint64_t now = current_time(&ctx->timer);
+  pthread_mutex_lock(&grp->lock);
+  roll_period(grp, now);
+  if (proc->quota_period == grp->period_start) {
+    /* A stall after a migration may have run past the reservation */
+    grp->used = grp->used - proc->quota_slots + ran;
+  } else {
+    /* The reservation went with its period, charge the part of this one */
+    uint64_t since = now - grp->period_start;
+    grp->used += ran < since ? ran : since;
+  }
+  if (grp->used > grp->quota)
+    grp->used = grp->quota;
+  pthread_mutex_unlock(&grp->lock);
+  proc->quota_slots = 0;
+}
+
+void group_destroy(struct sim_ctx *ctx) {
+  int i;
+  for (i = 0; i < ctx->nr_groups; i++)
+    pthread_mutex_destroy(&ctx->groups[i].lock);
+  ctx->nr_groups = 0;
+}
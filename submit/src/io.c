@@ -0,0 +1,135 @@
+
+#include "io.h"
+#include "sched.h"
+#include "sim.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int io_lookup(struct sim_ctx *ctx, const char *name, int latency, int depth) {
+  int i;
+  for (i = 0; i < ctx->nr_io_devs; i++) {
+    if (strcmp(ctx->io[i].name, name) == 0)
+      return i;
+  }
+  if (ctx->nr_io_devs == IO_MAX_DEVS || strlen(name) >= IO_NAME_LEN)
+    return -1;
+
+  /* Only the loader adds devices, before any process can use them */
+  struct io_device *dev = &ctx->io[ctx->nr_io_devs];
+  memset(dev, 0, sizeof(*dev));
+  strcpy(dev->name, name);
+  dev->latency = latency;
+  dev->depth = depth;
+  return ctx->nr_io_devs++;
+}
+
+static int req_before(struct io_req *a, struct io_req *b) {
+  if (a->done != b->done)
+    return a->done < b->done;
+  return a->seq < b->seq;
+}
+
+uint64_t io_submit(struct sim_ctx *ctx, struct pcb_t *proc, int id,
+                   uint32_t slots) {
+  struct io_device *dev = &ctx->io[id];
+  uint64_t now = current_time(&ctx->timer);
+  proc->stats.blocked_since = now;
+
+  pthread_mutex_lock(&ctx->io_lock);
+  /* Served by the channel free first, from the next slot on */
+  int ch, best = 0;
+  for (ch = 1; ch < dev->depth; ch++) {
+    if (dev->free_at[ch] < dev->free_at[best])
+      best = ch;
+  }
+  uint64_t start = dev->free_at[best] > now + 1 ? dev->free_at[best] : now + 1;
+  struct io_req req = {start + dev->latency + slots, ctx->io_seq++, proc, id};
+  dev->free_at[best] = req.done;
+  dev->requests++;
+  dev->wait_slots += start - (now + 1);
+  dev->service_slots += req.done - start;
+
+  if (ctx->io_nreq == ctx->io_cap) {
+    int cap = ctx->io_cap ? 2 * ctx->io_cap : 8;
+    ctx->io_reqs =
+        (struct io_req *)realloc(ctx->io_reqs, cap * sizeof(struct io_req));
+    if (ctx->io_reqs == NULL) {
+      fprintf(stderr, "Out of memory growing the I/O requests to %d\n", cap);
+      abort();
+    }
+    ctx->io_cap = cap;
+  }
+  /* Sift up */
+  int i = ctx->io_nreq++;
+  while (i > 0 && req_before(&req, &ctx->io_reqs[(i - 1) / 2])) {
+    ctx->io_reqs[i] = ctx->io_reqs[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  ctx->io_reqs[i] = req;
+  /* Pairs with sched_park_io: either the controller sees the request or
+   * we see it parked */
+  __atomic_fetch_add(&ctx->nr_io, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&ctx->io_lock);
+
+  sched_wake_io(ctx);
+  return req.done;
+}
+
+/* Take the request completing first off the heap if it is due by [now],
+ * io_lock held */
+static int pop_due(struct sim_ctx *ctx, uint64_t now, struct io_req *req) {
+  if (ctx->io_nreq == 0 || ctx->io_reqs[0].done > now)
+    return 0;
+  *req = ctx->io_reqs[0];
+  struct io_req last = ctx->io_reqs[--ctx->io_nreq];
+  /* Sift the last one down from the root */
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= ctx->io_nreq)
+      break;
+    if (child + 1 < ctx->io_nreq &&
+        req_before(&ctx->io_reqs[child + 1], &ctx->io_reqs[child]))
+      child++;
+    if (!req_before(&ctx->io_reqs[child], &last))
+      break;
+    ctx->io_reqs[i] = ctx->io_reqs[child];
+    i = child;
+  }
+  if (ctx->io_nreq > 0)
+    ctx->io_reqs[i] = last;
+  return 1;
+}
+
+int io_complete(struct sim_ctx *ctx, uint64_t *next) {
+  uint64_t now = current_time(&ctx->timer);
+  struct io_req req;
+  int n;
+  for (n = 0;; n++) {
+    pthread_mutex_lock(&ctx->io_lock);
+    if (!pop_due(ctx, now, &req)) {
+      *next = ctx->io_nreq ? ctx->io_reqs[0].done : UINT64_MAX;
+      pthread_mutex_unlock(&ctx->io_lock);
+      return n;
+    }
+    pthread_mutex_unlock(&ctx->io_lock);
+
+    struct pcb_t *proc = req.proc;
+    proc->stats.blocked += now - proc->stats.blocked_since;
+    fprintf(ctx->out, "\tI/O %s: process %2d done\n", ctx->io[req.dev].name,
+            proc->pid);
+    wake_proc(ctx, proc);
+    /* Only once it is queued, see sched_done */
+    __atomic_fetch_sub(&ctx->nr_io, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+void io_destroy(struct sim_ctx *ctx) {
+  free(ctx->io_reqs);
+  ctx->io_reqs = NULL;
+  ctx->io_cap = 0;
+  ctx->io_nreq = 0;
+}
@@ -1,16 +1,28 @@
 
 #include "loader.h"
+#include "cpu.h"
+#include "io.h"
+#include "sim.h"
+#include "sync.h"
+#include "thread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static uint32_t avail_pid = 1;
-
 #define OPT_CALC "calc"
 #define OPT_ALLOC "alloc"
 #define OPT_FREE "free"
 #define OPT_READ "read"
 #define OPT_WRITE "write"
+#define OPT_LOCK "lock"
+#define OPT_UNLOCK "unlock"
+#define OPT_WAIT "wait"
+#define OPT_SIGNAL "signal"
+#define OPT_IO "io"
+#define OPT_SPAWN "spawn"
+#define OPT_JOIN "join"
+#define OPT_COPY "copy"
+#define OPT_FILL "fill"
 
 static enum ins_opcode_t get_opcode(char *opt)
 {
@@ -34,6 +46,42 @@ static enum ins_opcode_t get_opcode(char *opt)
 	{
 		return WRITE;
 	}
+	else if (!strcmp(opt, OPT_LOCK))
+	{
+		return LOCK;
+	}
+	else if (!strcmp(opt, OPT_UNLOCK))
+	{
+		return UNLOCK;
+	}
+	else if (!strcmp(opt, OPT_WAIT))
+	{
+		return WAIT;
+	}
+	else if (!strcmp(opt, OPT_SIGNAL))
+	{
+		return SIGNAL;
+	}
+	else if (!strcmp(opt, OPT_IO))
+	{
+		return IO;
+	}
+	else if (!strcmp(opt, OPT_SPAWN))
+	{
+		return SPAWN;
+	}
+	else if (!strcmp(opt, OPT_JOIN))
+	{
+		return JOIN;
+	}
+	else if (!strcmp(opt, OPT_COPY))
+	{
+		return COPY;
+	}
+	else if (!strcmp(opt, OPT_FILL))
+	{
+		return FILL;
+	}
 	else
 	{
 		printf("Opcode: %s\n", opt);
@@ -41,14 +89,16 @@ static enum ins_opcode_t get_opcode(char *opt)
 	}
 }
 
-struct pcb_t *load(const char *path)
+struct pcb_t *load(struct sim_ctx *ctx, const char *path)
 {
 	/* Create new PCB for the new process */
-	struct pcb_t *proc = (struct pcb_t *)malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
+	struct pcb_t *proc = (struct pcb_t *)calloc(1, sizeof(struct pcb_t));
+	proc->ctx = ctx;
+	/* Threads take pids too, from the CPUs */
+	proc->pid = __atomic_fetch_add(&ctx->avail_pid, 1, __ATOMIC_RELAXED);
+	proc->tgid = proc->pid;
 	proc->page_table =
-		(struct page_table_t *)malloc(sizeof(struct page_table_t));
+		(struct page_table_t *)calloc(1, sizeof(struct page_table_t));
 	proc->bp = PAGE_SIZE;
 	proc->pc = 0;
 
@@ -61,6 +111,7 @@ struct pcb_t *load(const char *path)
 	}
 	char opcode[10];
 	proc->code = (struct code_seg_t *)malloc(sizeof(struct code_seg_t));
+	proc->code->ops = NULL;
 	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
 	// printf("Process priority is %u, code size is %u\n", proc->priority, proc->code->size);
 	proc->code->text = (struct inst_t *)malloc(
@@ -86,10 +137,87 @@ struct pcb_t *load(const char *path)
 		case WRITE:
 			sscanf(line, "%u %u %u\n", &proc->code->text[i].arg_0, &proc->code->text[i].arg_1, &proc->code->text[i].arg_2);
 			break;
+		case LOCK:
+		case UNLOCK:
+		case WAIT:
+		case SIGNAL:
+		{
+			/* arg_0: index of the named object, a mutex starts free
+			 * and a semaphore empty unless a "sem" line says else */
+			char name[100];
+			int mutex = proc->code->text[i].opcode == LOCK ||
+				proc->code->text[i].opcode == UNLOCK;
+			int id = -1;
+			if (sscanf(line, "%99s", name) == 1)
+				id = sync_lookup(ctx, name,
+					mutex ? SYNC_MUTEX : SYNC_SEM, mutex);
+			if (id < 0)
+			{
+				printf("Bad sync object in %s: %s", path, line);
+				exit(1);
+			}
+			proc->code->text[i].arg_0 = id;
+			break;
+		}
+		case IO:
+		{
+			/* arg_0: index of the device, arg_1: slots of the request */
+			char name[100];
+			uint32_t slots = 0;
+			int id = -1;
+			if (sscanf(line, "%99s %u", name, &slots) == 2 && slots > 0)
+				id = io_lookup(ctx, name, IO_LATENCY, IO_QUEUE_DEPTH);
+			if (id < 0)
+			{
+				printf("Bad I/O request in %s: %s", path, line);
+				exit(1);
+			}
+			proc->code->text[i].arg_0 = id;
+			proc->code->text[i].arg_1 = slots;
+			break;
+		}
+		case SPAWN:
+			/* arg_0: instructions the thread runs, right after this
+			 * one */
+			if (sscanf(line, "%u", &proc->code->text[i].arg_0) != 1 ||
+				proc->code->text[i].arg_0 == 0 ||
+				proc->code->text[i].arg_0 >= proc->code->size - i)
+			{
+				printf("Bad spawn in %s: %s", path, line);
+				exit(1);
+			}
+			break;
+		case JOIN:
+			break;
+		case COPY:
+			/* [source region] [offset] [destination region]
+			 * [offset] [bytes] */
+			if (sscanf(line, "%u %u %u %u %u",
+				&proc->code->text[i].arg_0, &proc->code->text[i].arg_1,
+				&proc->code->text[i].arg_2, &proc->code->text[i].arg_3,
+				&proc->code->text[i].arg_4) != 5)
+			{
+				printf("Bad copy in %s: %s", path, line);
+				exit(1);
+			}
+			break;
+		case FILL:
+			/* [region] [offset] [bytes] [value] */
+			if (sscanf(line, "%u %u %u %u",
+				&proc->code->text[i].arg_0, &proc->code->text[i].arg_1,
+				&proc->code->text[i].arg_2, &proc->code->text[i].arg_3) != 4 ||
+				proc->code->text[i].arg_3 > 255)
+			{
+				printf("Bad fill in %s: %s", path, line);
+				exit(1);
+			}
+			break;
 		default:
 			printf("Opcode: %s\n", opcode);
 			exit(1);
 		}
 	}
+	cpu_decode(proc->code);
+	proc->end = proc->code->size;
 	return proc;
 }
@@ -7,6 +7,14 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+/* Bytes up to [end] of [mp] may no longer be zero */
+static void MEMPHY_mark(struct memphy_struct *mp, int end)
+{
+   if (end > mp->dump_end)
+      mp->dump_end = end;
+}
 
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
@@ -86,6 +94,7 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value)
 
    MEMPHY_mv_csr(mp, addr);
    mp->storage[addr] = value;
+   MEMPHY_mark(mp, addr + 1);
    //printf("write MEMPHY[%d]: %d\n", addr, mp->storage[addr]);
 
    return 0;
@@ -103,13 +112,72 @@ int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data)
       return -1;
 
    if (mp->rdmflg)
+   {
       mp->storage[addr] = data;
+      MEMPHY_mark(mp, addr + 1);
+   }
    else /* Sequential access device */
       return MEMPHY_seq_write(mp, addr, data);
 
    return 0;
 }
 
+/*
+ *  MEMPHY_read_block - read a block of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: address of the first byte
+ *  @buf: where the bytes go
+ *  @len: number of bytes
+ */
+int MEMPHY_read_block(struct memphy_struct *mp, int addr, BYTE *buf, int len)
+{
+   if (mp == NULL || addr < 0 || len < 0 || addr + len > mp->maxsz)
+      return -1;
+
+   if (mp->rdmflg)
+   {
+      memcpy(buf, mp->storage + addr, len);
+      return 0;
+   }
+
+   /* Sequential access device */
+   int i;
+   for (i = 0; i < len; i++)
+      if (MEMPHY_read(mp, addr + i, &buf[i]) != 0)
+         return -1;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_block - write a block of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: address of the first byte
+ *  @buf: written bytes
+ *  @len: number of bytes
+ */
+int MEMPHY_write_block(struct memphy_struct *mp, int addr, const BYTE *buf,
+                       int len)
+{
+   if (mp == NULL || addr < 0 || len < 0 || addr + len > mp->maxsz)
+      return -1;
+
+   if (mp->rdmflg)
+   {
+      memcpy(mp->storage + addr, buf, len);
+      MEMPHY_mark(mp, addr + len);
+      return 0;
+   }
+
+   /* Sequential access device */
+   int i;
+   for (i = 0; i < len; i++)
+      if (MEMPHY_write(mp, addr + i, buf[i]) != 0)
+         return -1;
+
+   return 0;
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
@@ -118,26 +186,15 @@ int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
    /* This setting come with fixed constant PAGESZ */
    int numfp = mp->maxsz / pagesz;
-   struct framephy_struct *newfst, *fst;
-   int iter = 0;
 
    if (numfp <= 0)
       return -1;
 
-   /* Init head of free framephy list */
-   fst = malloc(sizeof(struct framephy_struct));
-   fst->fpn = iter;
-   mp->free_fp_list = fst;
-
-   /* We have list with first element, fill in the rest num-1 element member*/
-   for (iter = 1; iter < numfp; iter++)
-   {
-      newfst = malloc(sizeof(struct framephy_struct));
-      newfst->fpn = iter;
-      newfst->fp_next = NULL;
-      fst->fp_next = newfst;
-      fst = newfst;
-   }
+   /* Every frame is free, in fpn order. They only get a node in
+    * free_fp_list once they are put back, see MEMPHY_get_freefp */
+   mp->free_fp_list = NULL;
+   mp->fresh_fpn = 0;
+   mp->fresh_end = numfp;
 
    return 0;
 }
@@ -146,8 +203,15 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 {
    struct framephy_struct *fp = mp->free_fp_list;
 
+   /* The frames put back come first, as they were pushed in front of
+    * the never used ones */
    if (fp == NULL)
-      return -1;
+   {
+      if (mp->fresh_fpn >= mp->fresh_end)
+         return -1;
+      *retfpn = mp->fresh_fpn++;
+      return 0;
+   }
 
    *retfpn = fp->fpn;
    mp->free_fp_list = fp->fp_next;
@@ -161,39 +225,53 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 }
 
 // MEMPHY_dump : done
-int MEMPHY_dump(struct memphy_struct *mp)
+int MEMPHY_dump(struct memphy_struct *mp, FILE *out)
 {
    /*TODO dump memphy contnt mp->storage
     *     for tracing the memory content
     */
-   printf("Memory Dump:\n");
+   fprintf(out, "Memory Dump:\n");
 
    if(mp == NULL){
-    	printf("Physical Memory is not available\n");
+    	fprintf(out, "Physical Memory is not available\n");
     	return -1;  
     }
     
     if(mp -> storage == NULL){
-    	printf("No value to print out\n"); 
+    	fprintf(out, "No value to print out\n"); 
     	return -1; 
     }
 
-   for (int i = 0; i < mp->maxsz; ++i)
+   /* Memory is mostly zero, skip it a word at a time. Nothing past
+    * dump_end was ever written */
+   int i = 0;
+   while (i < mp->dump_end)
    {
+      uint64_t word;
+      if (i + (int)sizeof(word) <= mp->dump_end)
+      {
+         memcpy(&word, &mp->storage[i], sizeof(word));
+         if (word == 0)
+         {
+            i += sizeof(word);
+            continue;
+         }
+      }
       if (mp->storage[i] != 0)
       {
-         printf("BYTE %08x: %d\n", i, mp->storage[i]);
+         fprintf(out, "BYTE %08x: %d\n", i, mp->storage[i]);
       }
+      i++;
    }
 
-   printf("\n");
+   fprintf(out, "\n");
    return 0;
 }
 
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
 {
    struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   struct framephy_struct *newnode = calloc(1, sizeof(struct framephy_struct));
 
    /* Create new node with value fpn */
    newnode->fpn = fpn;
@@ -208,8 +286,9 @@ int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
  */
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
 {
-   mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
+   mp->storage = (BYTE *)calloc(max_size, sizeof(BYTE));
    mp->maxsz = max_size;
+   mp->dump_end = 0;
 
    MEMPHY_format(mp, PAGING_PAGESZ);
 
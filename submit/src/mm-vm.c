@@ -5,14 +5,13 @@
  */
 
 #include "mm.h"
+#include "sim.h"
 #include "string.h"
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-// synchronized for vm
-static pthread_mutex_t vm_lock = PTHREAD_MUTEX_INITIALIZER;
-
 /*enlist_vm_freerg_list - add new rg to freerg_list
  *@mm: memory region
  *@rg_elmt: new region
@@ -90,7 +89,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size,
     return -1;
   }
 
-  pthread_mutex_lock(&vm_lock);
+  pthread_mutex_lock(&caller->ctx->vm_lock);
 
   if (get_free_vmrg_area(caller, vmaid, size, &rgnode) == 0) {
 
@@ -100,7 +99,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size,
 
     *alloc_addr = rgnode.rg_start;
 
-    pthread_mutex_unlock(&vm_lock);
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
     return 0;
   }
 
@@ -123,7 +122,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size,
 
   *alloc_addr = old_sbrk;
 
-  pthread_mutex_unlock(&vm_lock);
+  pthread_mutex_unlock(&caller->ctx->vm_lock);
   return 0;
 }
 
@@ -142,21 +141,26 @@ int __free(struct pcb_t *caller, int vmaid, int rgid) {
   }
   /* TODO: Manage the collect freed region to freerg_list */
 
+  /* The symbol table is shared by the threads of the process, one of
+   * them may free the region at the same time */
+  pthread_mutex_lock(&caller->ctx->vm_lock);
+
   // Get the region need to be freed
   struct vm_rg_struct *dealloc_rg = get_symrg_byid(caller->mm, rgid);
 
   if (dealloc_rg->is_alloc != 1) {
-    printf("Unable to delocated memory region %d\n", rgid);
-    printf("This memory region has not been allocated yet !!\n"); 
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
+    fprintf(caller->ctx->out, "Unable to delocated memory region %d\n", rgid);
+    fprintf(caller->ctx->out,
+            "This memory region has not been allocated yet !!\n");
     return -1;
   }
 
   if (dealloc_rg->rg_start == dealloc_rg->rg_end) {
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
     return -1;
   }
 
-  pthread_mutex_lock(&vm_lock);
-
   struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
 
   // Assign the rgnode with appropriate values
@@ -172,7 +176,7 @@ int __free(struct pcb_t *caller, int vmaid, int rgid) {
   /*enlist the obsoleted memory region */
   enlist_vm_freerg_list(caller->mm, rgnode);
 
-  pthread_mutex_unlock(&vm_lock);
+  pthread_mutex_unlock(&caller->ctx->vm_lock);
 
   return 0;
 }
@@ -241,7 +245,7 @@ int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller) {
 
     /* Do swap frame from MEMRAM to MEMSWP and vice versa*/
     /* Copy victim frame to swap */
-    __swap_cp_page(vicfp->mapping_process->mram, vicfpn, caller->active_mswp,
+    __swap_cp_page(caller->mram, vicfpn, caller->active_mswp,
                    swpfpn);
     /* Copy target frame from swap to mem */
     __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicfpn);
@@ -254,6 +258,9 @@ int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller) {
     /* Update its online status of the target page */
     // frame number of target page is the frame number of victim page
     pte_set_fpn(&mm->pgd[pgn], vicfpn);
+    /* The frame it is in now, under vm_lock: a sibling thread faulting on
+     * the same page next finds it present */
+    pte = mm->pgd[pgn];
 
     *fpn = PAGING_FPN(pte);
 
@@ -330,11 +337,15 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value,
  // __read :    --> go to pg_getval function
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data) {
 
+  /* A sibling thread may free the region, or fault on the same page */
+  pthread_mutex_lock(&caller->ctx->vm_lock);
+
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   if (!currg->is_alloc) {
     /*printf("process %d access violation reading location: memory region %d\n",
            caller->pid, rgid);*/
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
     return -1;
   }
 
@@ -342,14 +353,13 @@ int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data) {
 
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
   {
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
     return -1;
   }
 
-  pthread_mutex_lock(&vm_lock);
-
   pg_getval(caller->mm, currg->rg_start + offset, data, caller);
 
-  pthread_mutex_unlock(&vm_lock);
+  pthread_mutex_unlock(&caller->ctx->vm_lock);
 
   return 0;
 }
@@ -368,11 +378,11 @@ int pgread(struct pcb_t *proc, // Process executing the instruction
 
   destination = (uint32_t)data;
 #ifdef IODUMP
-  printf("process %d read region=%d offset=%d value=%d\n\n", proc->pid, source,
-         offset, data);
+  fprintf(proc->ctx->out, "process %d read region=%d offset=%d value=%d\n\n",
+          proc->pid, source, offset, data);
   print_pgtbl(proc, 0, -1); // print max TBL
 #ifdef MEMPHYS_DUMP
-  MEMPHY_dump(proc->mram);
+  MEMPHY_dump(proc->mram, proc->ctx->out);
 #endif
 #endif
 
@@ -389,10 +399,15 @@ int pgread(struct pcb_t *proc, // Process executing the instruction
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value) {
 
+  /* A sibling thread may free the region, or fault on the same page */
+  pthread_mutex_lock(&caller->ctx->vm_lock);
+
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   if (!currg->is_alloc) {
-    printf("access violation writing location: memory region %d\n", rgid);
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
+    fprintf(caller->ctx->out,
+            "access violation writing location: memory region %d\n", rgid);
     return -1;
   }
 
@@ -400,14 +415,13 @@ int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value) {
 
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
   {
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
     return -1;
   }
 
-  pthread_mutex_lock(&vm_lock);
-
   pg_setval(caller->mm, currg->rg_start + offset, value, caller);
 
-  pthread_mutex_unlock(&vm_lock);
+  pthread_mutex_unlock(&caller->ctx->vm_lock);
   return 0;
 }
 
@@ -417,15 +431,16 @@ int pgwrite(struct pcb_t *proc,   // Process executing the instruction
             uint32_t destination, // Index of destination register
             uint32_t offset) {
 #ifdef IODUMP
-  printf("process %d write region=%d offset=%d value=%d\n\n", proc->pid,
-         destination, offset, data);
+  fprintf(proc->ctx->out, "process %d write region=%d offset=%d value=%d\n\n",
+          proc->pid, destination, offset, data);
 #endif
   uint32_t max_offset = proc->mm->symrgtbl[destination].rg_end -
                         proc->mm->symrgtbl[destination].rg_start - 1;
 
   if (offset > max_offset) {
-    printf("process %d access violation writing location: memory region %d\n",
-           proc->pid, destination);
+    fprintf(proc->ctx->out,
+            "process %d access violation writing location: memory region %d\n",
+            proc->pid, destination);
     return -1;
   }
 
@@ -434,12 +449,191 @@ int pgwrite(struct pcb_t *proc,   // Process executing the instruction
     print_pgtbl(proc, 0, -1); // print max TBL
   }
 #ifdef MEMPHYS_DUMP
-  MEMPHY_dump(proc->mram);
+  MEMPHY_dump(proc->mram, proc->ctx->out);
 #endif
 
   return status;
 }
 
+/* Allocated region [rgid] of [mm] if the [len] bytes from [offset] are all
+ * in it, NULL otherwise */
+static struct vm_rg_struct *get_range(struct mm_struct *mm, int rgid,
+                                      int offset, int len) {
+  if (rgid < 0 || rgid >= PAGING_MAX_SYMTBL_SZ || offset < 0 || len < 0)
+    return NULL;
+  struct vm_rg_struct *rg = get_symrg_byid(mm, rgid);
+  if (rg == NULL || !rg->is_alloc ||
+      (unsigned long)offset + len > rg->rg_end - rg->rg_start)
+    return NULL;
+  return rg;
+}
+
+/* Address in MEMRAM of virtual address [addr] of [caller], its page brought
+ * in first. -1 if the page is invalid */
+static int pg_phyaddr(struct pcb_t *caller, int addr) {
+  int fpn;
+  if (pg_getpage(caller->mm, PAGING_PGN(addr), &fpn, caller) != 0)
+    return -1;
+  return (fpn << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr);
+}
+
+/*__copy - copy bytes between region memories
+ *@caller: caller
+ *@vmaid: ID vm area of the regions
+ *@srcrg/srcoff: first byte read
+ *@dstrg/dstoff: first byte written
+ *@len: number of bytes
+ *
+ * Moved in chunks that stay within one page on both sides, so each page is
+ * translated once per chunk rather than once per byte. The chunks go
+ * backwards when the destination overlaps the end of the source.
+ */
+int __copy(struct pcb_t *caller, int vmaid, int srcrg, int srcoff, int dstrg,
+           int dstoff, int len) {
+  /* Same as __read and __write */
+  pthread_mutex_lock(&caller->ctx->vm_lock);
+
+  struct vm_rg_struct *src = get_range(caller->mm, srcrg, srcoff, len);
+  struct vm_rg_struct *dst = get_range(caller->mm, dstrg, dstoff, len);
+  if (src == NULL || dst == NULL || get_vma_by_num(caller->mm, vmaid) == NULL) {
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
+    return -1;
+  }
+
+  int from = src->rg_start + srcoff;
+  int to = dst->rg_start + dstoff;
+  int back = to > from && to < from + len;
+  BYTE buf[PAGING_PAGESZ];
+  int done = 0;
+  while (done < len) {
+    int n = len - done, s, d;
+    if (back) {
+      /* Last bytes left on each side */
+      s = from + len - done - 1;
+      d = to + len - done - 1;
+      if (n > PAGING_OFFST(s) + 1)
+        n = PAGING_OFFST(s) + 1;
+      if (n > PAGING_OFFST(d) + 1)
+        n = PAGING_OFFST(d) + 1;
+      s -= n - 1;
+      d -= n - 1;
+    } else {
+      s = from + done;
+      d = to + done;
+      if (n > PAGING_PAGESZ - PAGING_OFFST(s))
+        n = PAGING_PAGESZ - PAGING_OFFST(s);
+      if (n > PAGING_PAGESZ - PAGING_OFFST(d))
+        n = PAGING_PAGESZ - PAGING_OFFST(d);
+    }
+    /* The source page may be swapped out to bring the destination in, so
+     * it is read out first */
+    int phyaddr = pg_phyaddr(caller, s);
+    if (phyaddr < 0 || MEMPHY_read_block(caller->mram, phyaddr, buf, n) != 0)
+      break;
+    phyaddr = pg_phyaddr(caller, d);
+    if (phyaddr < 0 || MEMPHY_write_block(caller->mram, phyaddr, buf, n) != 0)
+      break;
+    done += n;
+  }
+
+  pthread_mutex_unlock(&caller->ctx->vm_lock);
+  return done == len ? 0 : -1;
+}
+
+/*__fill - set bytes of a region memory to a value
+ *@caller: caller
+ *@vmaid: ID vm area of the region
+ *@rgid: memory region ID
+ *@offset: first byte written
+ *@len: number of bytes
+ *@value: value
+ *
+ * One page translation per page written, as in __copy.
+ */
+int __fill(struct pcb_t *caller, int vmaid, int rgid, int offset, int len,
+           BYTE value) {
+  pthread_mutex_lock(&caller->ctx->vm_lock);
+
+  struct vm_rg_struct *currg = get_range(caller->mm, rgid, offset, len);
+  if (currg == NULL || get_vma_by_num(caller->mm, vmaid) == NULL) {
+    pthread_mutex_unlock(&caller->ctx->vm_lock);
+    return -1;
+  }
+
+  BYTE buf[PAGING_PAGESZ];
+  memset(buf, value, len < PAGING_PAGESZ ? len : PAGING_PAGESZ);
+  int addr = currg->rg_start + offset;
+  int end = addr + len;
+  while (addr < end) {
+    int n = end - addr;
+    if (n > PAGING_PAGESZ - PAGING_OFFST(addr))
+      n = PAGING_PAGESZ - PAGING_OFFST(addr);
+    int phyaddr = pg_phyaddr(caller, addr);
+    if (phyaddr < 0 || MEMPHY_write_block(caller->mram, phyaddr, buf, n) != 0)
+      break;
+    addr += n;
+  }
+
+  pthread_mutex_unlock(&caller->ctx->vm_lock);
+  return addr == end ? 0 : -1;
+}
+
+/*pgcopy - PAGING-based copy between region memories */
+int pgcopy(struct pcb_t *proc,   // Process executing the instruction
+           uint32_t source,      // Index of source register
+           uint32_t srcoff,      // Source address = [source] + [srcoff]
+           uint32_t destination, // Index of destination register
+           uint32_t dstoff,      // Destination address = [destination] + [dstoff]
+           uint32_t len) {       // Number of bytes
+#ifdef IODUMP
+  fprintf(proc->ctx->out,
+          "process %d copy region=%d offset=%d to region=%d offset=%d "
+          "len=%d\n\n",
+          proc->pid, source, srcoff, destination, dstoff, len);
+#endif
+  if (srcoff > INT_MAX || dstoff > INT_MAX || len > INT_MAX ||
+      __copy(proc, 0, source, srcoff, destination, dstoff, len) != 0) {
+    fprintf(proc->ctx->out,
+            "process %d access violation copying memory region %d to %d\n",
+            proc->pid, source, destination);
+    return -1;
+  }
+
+  print_pgtbl(proc, 0, -1); // print max TBL
+#ifdef MEMPHYS_DUMP
+  MEMPHY_dump(proc->mram, proc->ctx->out);
+#endif
+
+  return 0;
+}
+
+/*pgfill - PAGING-based fill of a region memory */
+int pgfill(struct pcb_t *proc,   // Process executing the instruction
+           uint32_t destination, // Index of destination register
+           uint32_t offset,      // First address = [destination] + [offset]
+           uint32_t len,         // Number of bytes
+           BYTE data) {          // Value written to each of them
+#ifdef IODUMP
+  fprintf(proc->ctx->out,
+          "process %d fill region=%d offset=%d len=%d value=%d\n\n",
+          proc->pid, destination, offset, len, data);
+#endif
+  if (offset > INT_MAX || len > INT_MAX ||
+      __fill(proc, 0, destination, offset, len, data) != 0) {
+    fprintf(proc->ctx->out,
+            "process %d access violation writing location: memory region %d\n",
+            proc->pid, destination);
+    return -1;
+  }
+
+  print_pgtbl(proc, 0, -1); // print max TBL
+#ifdef MEMPHYS_DUMP
+  MEMPHY_dump(proc->mram, proc->ctx->out);
+#endif
+
+  return 0;
+}
+
 /*free_pcb_memphy - collect all memphy of pcb
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -5,6 +5,7 @@
  */
 
 #include "mm.h"
+#include "sim.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -170,7 +171,7 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
       victimpgn = victim_fp -> pte_id; 
       // get frame number of victim frame
       int victimfpn = victim_fp -> fpn; 
-      __swap_cp_page(victim_fp->mapping_process->mram, victimfpn, caller->active_mswp, swpfpn);
+      __swap_cp_page(caller->mram, victimfpn, caller->active_mswp, swpfpn);
       pte_set_swap(&victim_fp->owner->pgd[victimpgn], 0, swpfpn);
       newfp_str->fpn = victimfpn;
       newfp_str->owner = caller->mm;
@@ -216,7 +217,7 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
   if (ret_alloc == -3000)
   {
 #ifdef MMDBG
-    printf("OOM: vm_map_ram out of memory \n");
+    fprintf(caller->ctx->out, "OOM: vm_map_ram out of memory \n");
 #endif
     return -1;
   }
@@ -259,9 +260,9 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
  */
 int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
-  struct vm_area_struct *vma = malloc(sizeof(struct vm_area_struct));
+  struct vm_area_struct *vma = calloc(1, sizeof(struct vm_area_struct));
 
-  mm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t));
+  mm->pgd = calloc(PAGING_MAX_PGN, sizeof(uint32_t));
 
   /* By default the owner comes with at least one vma */
   vma->vm_id = 1;
@@ -415,22 +416,22 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
   pgn_start = PAGING_PGN(start);
   pgn_end = PAGING_PGN(end);
 
-  printf("print_pgtbl: %d - %d", start, end);
+  fprintf(caller->ctx->out, "print_pgtbl: %d - %d", start, end);
   if (caller == NULL)
   {
-    printf("NULL caller\n");
+    fprintf(caller->ctx->out, "NULL caller\n");
     return -1;
   }
-  printf("\n");
+  fprintf(caller->ctx->out, "\n");
 
   for (pgit = pgn_start; pgit < pgn_end; pgit++)
   {
-    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
+    fprintf(caller->ctx->out, "%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
   }
 
   for (pgit = pgn_start; pgit < pgn_end; pgit++)
   {
-    printf("Page Number: %d -> Frame Number: %d\n", pgit, PAGING_FPN(caller->mm->pgd[pgit]));
+    fprintf(caller->ctx->out, "Page Number: %d -> Frame Number: %d\n", pgit, PAGING_FPN(caller->mm->pgd[pgit]));
   }
 
   return 0;
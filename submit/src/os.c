@@ -1,277 +1,130 @@
-
-#include "cpu.h"
-#include "loader.h"
-#include "mm.h"
+#include "ckpt.h"
 #include "sched.h"
-#include "timer.h"
+#include "stats.h"
+#include "sim.h"
 
-#include <os-cfg.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+static void usage(void) {
+  printf("Usage: os [-s | -j workers] [-p] [-q] [-P policy] [-m file] [-c "
+         "slot:file] [path to configure file]\n");
+  printf("       os [-s | -j workers] [-p] [-q] [-m file] -r file\n");
+  printf("  -s  run all CPUs and the loader on a single host thread\n");
+  printf("  -j  run all CPUs and the loader on a pool of host threads\n");
+  printf("  -p  pin each host thread to its own host core\n");
+  printf("  -q  slice mode: a CPU runs the calcs of its time slice at once\n");
+  printf("      and only syncs with the others at the instructions they\n");
+  printf("      can see, so preemption and hotplug wait for those\n");
+  printf("  -P  schedule with policy (mlq, cfs, fifo, stride, lottery or "
+         "group)\n");
+  printf("      instead of the one of the configure file\n");
+  printf("  -m  write the scheduling metrics to file at exit, as JSON if\n");
+  printf("      its name ends in .json, or else as CSV\n");
+  printf("  -c  write a checkpoint to file when the clock reaches slot\n");
+  printf("      (implies -s)\n");
+  printf("  -r  resume from a checkpoint instead of a configure file\n");
+}
 
-static int time_slot;
-static int num_cpus;
-static int done = 0;
-
-#ifdef MM_PAGING
-static int memramsz;
-static int memswpsz[PAGING_MAX_MMSWP];
-
-struct mmpaging_ld_args {
-  /* A dispatched argument struct to compact many-fields passing to loader */
-  struct memphy_struct *mram;
-  struct memphy_struct **mswp;
-  struct memphy_struct *active_mswp;
-  struct timer_id_t *timer_id;
-};
-#endif
-
-static struct ld_args {
-  char **path;
-  unsigned long *start_time;
-#ifdef MLQ_SCHED
-  unsigned long *prio;
-#endif
-} ld_processes;
-int num_processes;
-
-struct cpu_args {
-  struct timer_id_t *timer_id;
-  int id;
-};
-
-static void *cpu_routine(void *args) {
-  struct timer_id_t *timer_id = ((struct cpu_args *)args)->timer_id;
-  int id = ((struct cpu_args *)args)->id;
-  /* Check for new process in ready queue */
-  int time_left = 0;
-  struct pcb_t *proc = NULL;
-  while (1) {
-    /* Check the status of current process */
-    if (proc == NULL) {
-      /* No process is running, the we load new process from
-       * ready queue */
-      proc = get_proc();
-      if (proc == NULL) {
-        next_slot(timer_id);
-        continue; /* First load failed. skip dummy load */
+int main(int argc, char *argv[]) {
+  static struct sim_ctx ctx;
+  int sequential = 0;
+  int workers = 0;
+  int pin = 0;
+  int slice_mode = 0;
+  int policy = -1;
+  const char *ckpt_path = NULL;
+  unsigned long ckpt_slot = 0;
+  const char *restore_path = NULL;
+  const char *metrics_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "sj:pqP:m:c:r:")) != -1) {
+    switch (opt) {
+    case 's':
+      sequential = 1;
+      break;
+    case 'j':
+      workers = atoi(optarg);
+      if (workers < 1) {
+        usage();
+        return 1;
+      }
+      break;
+    case 'p':
+      pin = 1;
+      break;
+    case 'q':
+      slice_mode = 1;
+      break;
+    case 'P':
+      policy = sched_policy_by_name(optarg);
+      if (policy < 0) {
+        usage();
+        return 1;
+      }
+      break;
+    case 'm':
+      metrics_path = optarg;
+      break;
+    case 'c': {
+      char *sep;
+      ckpt_slot = strtoul(optarg, &sep, 10);
+      if (*sep != ':' || sep[1] == '\0') {
+        usage();
+        return 1;
       }
-    } else if (proc->pc == proc->code->size) {
-      /* The porcess has finish it job */
-      printf("\tCPU %d: Processed %2d has finished\n", id, proc->pid);
-      finish_proc(&proc);
-      proc = get_proc();
-      time_left = 0;
-    } else if (time_left == 0) {
-      /* The process has done its job in current time slot */
-      printf("\tCPU %d: Put process %2d to run queue\n", id, proc->pid);
-      put_proc(proc);
-      proc = get_proc();
+      ckpt_path = sep + 1;
+      sequential = 1;
+      break;
     }
-
-    /* Recheck process status after loading new process */
-    if (proc == NULL && done) {
-      /* No process to run, exit */
-      printf("\tCPU %d stopped\n", id);
+    case 'r':
+      restore_path = optarg;
       break;
-    } else if (proc == NULL) {
-      /* There may be new processes to run in
-       * next time slots, just skip current slot */
-      next_slot(timer_id);
-      continue;
-    } else if (time_left == 0) {
-      printf("\tCPU %d: Dispatched process %2d\n", id, proc->pid);
-      time_left = time_slot;
+    default:
+      usage();
+      return 1;
     }
-
-    /* Run current process */
-    run(proc);
-    time_left--;
-    next_slot(timer_id);
   }
-  detach_event(timer_id);
-  pthread_exit(NULL);
-}
 
-static void *ld_routine(void *args) {
-#ifdef MM_PAGING
-  struct memphy_struct *mram = ((struct mmpaging_ld_args *)args)->mram;
-  struct memphy_struct **mswp = ((struct mmpaging_ld_args *)args)->mswp;
-  struct memphy_struct *active_mswp =
-      ((struct mmpaging_ld_args *)args)->active_mswp;
-  struct timer_id_t *timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
-#else
-  struct timer_id_t *timer_id = (struct timer_id_t *)args;
-#endif
-  int i = 0;
-  printf("ld_routine\n");
-  while (i < num_processes) {
-    struct pcb_t *proc = load(ld_processes.path[i]);
-#ifdef MLQ_SCHED
-    proc->prio = ld_processes.prio[i];
-#endif
-    while (current_time() < ld_processes.start_time[i]) {
-      next_slot(timer_id);
+  if (restore_path != NULL) {
+    /* The queues of the checkpoint belong to its policy */
+    if (optind != argc || policy >= 0) {
+      usage();
+      return 1;
     }
-#ifdef MM_PAGING
-    proc->mm = malloc(sizeof(struct mm_struct));
-    init_mm(proc->mm, proc);
-    proc->mram = mram;
-    proc->mswp = mswp;
-    proc->active_mswp = active_mswp;
-#endif
-    printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
-           ld_processes.path[i], proc->pid, ld_processes.prio[i]);
-    add_proc(proc); // error when encrea cpu when not use
-
-    free(ld_processes.path[i]);
-    i++;
-    next_slot(timer_id);
-  }
-  free(ld_processes.path);
-  free(ld_processes.start_time);
-  done = 1;
-  detach_event(timer_id);
-  pthread_exit(NULL);
-}
-
-static void read_config(const char *path) {
-  FILE *file;
-  if ((file = fopen(path, "r")) == NULL) {
-    printf("Cannot find configure file at %s\n", path);
-    exit(1);
-  }
-  fscanf(file, "%d %d %d\n", &time_slot, &num_cpus, &num_processes);
-  ld_processes.path = (char **)malloc(sizeof(char *) * num_processes);
-  ld_processes.start_time =
-      (unsigned long *)malloc(sizeof(unsigned long) * num_processes);
-#ifdef MM_PAGING
-  int sit;
-#ifdef MM_FIXED_MEMSZ
-  /* We provide here a back compatible with legacy OS simulatiom config file
-   * In which, it have no addition config line for Mema, keep only one line
-   * for legacy info
-   *  [time slice] [N = Number of CPU] [M = Number of Processes to be run]
-   */
-  memramsz = 0x100000;
-  memswpsz[0] = 0x1000000;
-  for (sit = 1; sit < PAGING_MAX_MMSWP; sit++)
-    memswpsz[sit] = 0;
-#else
-  /* Read input config of memory size: MEMRAM and upto 4 MEMSWP (mem swap)
-   * Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
-   *        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
-   */
-  fscanf(file, "%d\n", &memramsz);
-  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
-    fscanf(file, "%d", &(memswpsz[sit]));
-  }
-  fscanf(file, "\n"); /* Final character */
-#endif
-#endif
-
-#ifdef MLQ_SCHED
-  ld_processes.prio =
-      (unsigned long *)malloc(sizeof(unsigned long) * num_processes);
-#endif
-  int i;
-  for (i = 0; i < num_processes; i++) {
-    ld_processes.path[i] = (char *)malloc(sizeof(char) * 100);
-    ld_processes.path[i][0] = '\0';
-    strcat(ld_processes.path[i], "input/proc/");
-    char proc[100];
-#ifdef MLQ_SCHED
-     /*fscanf(file, "%lu %s %lu\n", &ld_processes.start_time[i], proc,
-     &ld_processes.prio[i]);*/
-    char line[100];
-    fgets(line, 100, file);
-    sscanf(line, "%lu %s %lu", &ld_processes.start_time[i], proc,
-           &ld_processes.prio[i]);
-    // printf("line %d: %s\n", i, line);
-    // printf("process in file: %s\n", proc);
-    // printf("start time: %lu\n", ld_processes.start_time[i]);
-    // printf("process in file: %lu\n", ld_processes.prio[i]);
-#else
-    fscanf(file, "%lu %s\n", &ld_processes.start_time[i], proc);
-#endif
-    strcat(ld_processes.path[i], proc);
-  }
-}
-
-int main(int argc, char *argv[]) {
-  /* Read config */
-  if (argc != 2) {
-    printf("Usage: os [path to configure file]\n");
-    return 1;
-  }
-  char path[100];
-  path[0] = '\0';
-  strcat(path, "input/");
-  strcat(path, argv[1]);
-  read_config(path);
-
-  pthread_t *cpu = (pthread_t *)malloc(num_cpus * sizeof(pthread_t));
-  struct cpu_args *args =
-      (struct cpu_args *)malloc(sizeof(struct cpu_args) * num_cpus);
-  pthread_t ld;
-
-  /* Init timer */
-  int i;
-  for (i = 0; i < num_cpus; i++) {
-    args[i].timer_id = attach_event();
-    args[i].id = i;
-  }
-  struct timer_id_t *ld_event = attach_event();
-  start_timer();
-
-#ifdef MM_PAGING
-  /* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
-  int rdmflag = 1; /* By default memphy is RANDOM ACCESS MEMORY */
-
-  struct memphy_struct mram;
-  struct memphy_struct mswp[PAGING_MAX_MMSWP];
-
-  /* Create MEM RAM */
-  init_memphy(&mram, memramsz, rdmflag);
-
-  /* Create all MEM SWAP */
-  int sit;
-  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-    init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
-
-  /* In Paging mode, it needs passing the system mem to each PCB through
-   * loader*/
-  struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
-
-  mm_ld_args->timer_id = ld_event;
-  mm_ld_args->mram = (struct memphy_struct *)&mram;
-  mm_ld_args->mswp = (struct memphy_struct **)&mswp;
-  mm_ld_args->active_mswp = (struct memphy_struct *)&mswp[0];
-#endif
-
-  /* Init scheduler */
-  init_scheduler();
-
-  /* Run CPU and loader */
-#ifdef MM_PAGING
-  pthread_create(&ld, NULL, ld_routine, (void *)mm_ld_args);
-#else
-  pthread_create(&ld, NULL, ld_routine, (void *)ld_event);
-#endif
-  for (i = 0; i < num_cpus; i++) {
-    pthread_create(&cpu[i], NULL, cpu_routine, (void *)&args[i]);
-  }
-
-  /* Wait for CPU and loader finishing */
-  for (i = 0; i < num_cpus; i++) {
-    pthread_join(cpu[i], NULL);
+    if (ckpt_restore(&ctx, restore_path, stdout) < 0)
+      return 1;
+  } else {
+    /* Read config */
+    if (optind != argc - 1) {
+      usage();
+      return 1;
+    }
+    char path[100];
+    path[0] = '\0';
+    strcat(path, "input/");
+    strcat(path, argv[optind]);
+    if (sim_init(&ctx, path, stdout) < 0)
+      return 1;
+    /* No process is queued yet, and every run queue is set up for every
+     * policy */
+    if (policy >= 0)
+      ctx.policy = policy;
   }
-  pthread_join(ld, NULL);
-
-  /* Stop timer */
-  stop_timer();
-
-  return 0;
+  ctx.sequential = sequential;
+  ctx.workers = workers;
+  ctx.pin = pin;
+  ctx.slice_mode = slice_mode;
+  ctx.ckpt_path = ckpt_path;
+  ctx.ckpt_slot = ckpt_slot;
+
+  sim_run(&ctx);
+  int ret = 0;
+  if (metrics_path != NULL && stats_write(&ctx, metrics_path) < 0)
+    ret = 1;
+  sim_destroy(&ctx);
+
+  return ret;
 }
@@ -8,16 +8,44 @@ int empty(struct queue_t *q) {
   return (q->size == 0);
 }
 
+void init_queue(struct queue_t *q) {
+  q->proc = NULL;
+  q->head = 0;
+  q->size = 0;
+  q->cap = 0;
+}
+
+void free_queue(struct queue_t *q) {
+  free(q->proc);
+  init_queue(q);
+}
+
+/* Double the ring, unwrapping it so the oldest PCB is at index 0 */
+static void grow(struct queue_t *q) {
+  int cap = q->cap ? 2 * q->cap : QUEUE_INIT_SIZE;
+  struct pcb_t **proc = (struct pcb_t **)malloc(cap * sizeof(struct pcb_t *));
+  if (proc == NULL) {
+    fprintf(stderr, "Out of memory growing a queue to %d entries\n", cap);
+    abort();
+  }
+  int i;
+  for (i = 0; i < q->size; i++)
+    proc[i] = q->proc[(q->head + i) % q->cap];
+  free(q->proc);
+  q->proc = proc;
+  q->head = 0;
+  q->cap = cap;
+}
+
 void enqueue(struct queue_t *q, struct pcb_t *proc) {
   // Check for NULL queue or process
   if (q == NULL || proc == NULL) return;
-  // Check for full queue
-  if (q->size >= MAX_QUEUE_SIZE) {
-    printf("Full Queue!\n");
-    return;
-  }
-  // Add process to queue
-  q->proc[q->size] = proc;
+  // Make room for one more process
+  if (q->size == q->cap) grow(q);
+  // Add process behind the last one
+  int tail = q->head + q->size;
+  if (tail >= q->cap) tail -= q->cap;
+  q->proc[tail] = proc;
   // Increment queue size
   q->size++;
 }
@@ -25,11 +53,10 @@ void enqueue(struct queue_t *q, struct pcb_t *proc) {
 struct pcb_t *dequeue(struct queue_t *q) {
   // Check for NULL queue
   if (q == NULL || q->size == 0) return NULL;
-  struct pcb_t *first_proc = q->proc[0];
-  // Shift all processes to the left
-  for (int i = 0; i < q->size - 1; i++) {
-    q->proc[i] = q->proc[i + 1];
-  }
+  struct pcb_t *first_proc = q->proc[q->head];
+  // Only live entries are left in the ring (see ckpt.c)
+  q->proc[q->head] = NULL;
+  if (++q->head == q->cap) q->head = 0;
   // Decrement queue size
   q->size--;
   return first_proc;
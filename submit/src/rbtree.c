@@ -0,0 +1,238 @@
+#include "rbtree.h"
+
+#include <stdlib.h>
+
+#define IS_RED(n) ((n) != NULL && (n)->rb_color == RB_RED)
+
+void rb_init(struct rb_tree *t) {
+  t->root = NULL;
+  t->leftmost = NULL;
+  t->size = 0;
+}
+
+static void rotate_left(struct rb_tree *t, struct pcb_t *x) {
+  struct pcb_t *y = x->rb_right;
+  x->rb_right = y->rb_left;
+  if (y->rb_left != NULL)
+    y->rb_left->rb_parent = x;
+  y->rb_parent = x->rb_parent;
+  if (x->rb_parent == NULL)
+    t->root = y;
+  else if (x == x->rb_parent->rb_left)
+    x->rb_parent->rb_left = y;
+  else
+    x->rb_parent->rb_right = y;
+  y->rb_left = x;
+  x->rb_parent = y;
+}
+
+static void rotate_right(struct rb_tree *t, struct pcb_t *x) {
+  struct pcb_t *y = x->rb_left;
+  x->rb_left = y->rb_right;
+  if (y->rb_right != NULL)
+    y->rb_right->rb_parent = x;
+  y->rb_parent = x->rb_parent;
+  if (x->rb_parent == NULL)
+    t->root = y;
+  else if (x == x->rb_parent->rb_right)
+    x->rb_parent->rb_right = y;
+  else
+    x->rb_parent->rb_left = y;
+  y->rb_right = x;
+  x->rb_parent = y;
+}
+
+void rb_insert(struct rb_tree *t, struct pcb_t *z) {
+  struct pcb_t *y = NULL, *x = t->root;
+  int leftmost = 1;
+  while (x != NULL) {
+    y = x;
+    if (z->rb_key < x->rb_key) {
+      x = x->rb_left;
+    } else {
+      x = x->rb_right;
+      leftmost = 0;
+    }
+  }
+  z->rb_parent = y;
+  z->rb_left = NULL;
+  z->rb_right = NULL;
+  z->rb_color = RB_RED;
+  if (y == NULL)
+    t->root = z;
+  else if (z->rb_key < y->rb_key)
+    y->rb_left = z;
+  else
+    y->rb_right = z;
+  if (leftmost)
+    t->leftmost = z;
+  t->size++;
+
+  /* Restore the colors: no red node has a red parent */
+  struct pcb_t *p;
+  while ((p = z->rb_parent) != NULL && p->rb_color == RB_RED) {
+    struct pcb_t *g = p->rb_parent; /* The root is black, so it exists */
+    if (p == g->rb_left) {
+      struct pcb_t *u = g->rb_right;
+      if (IS_RED(u)) {
+        p->rb_color = RB_BLACK;
+        u->rb_color = RB_BLACK;
+        g->rb_color = RB_RED;
+        z = g;
+        continue;
+      }
+      if (z == p->rb_right) {
+        z = p;
+        rotate_left(t, z);
+        p = z->rb_parent;
+      }
+      p->rb_color = RB_BLACK;
+      g->rb_color = RB_RED;
+      rotate_right(t, g);
+    } else {
+      struct pcb_t *u = g->rb_left;
+      if (IS_RED(u)) {
+        p->rb_color = RB_BLACK;
+        u->rb_color = RB_BLACK;
+        g->rb_color = RB_RED;
+        z = g;
+        continue;
+      }
+      if (z == p->rb_left) {
+        z = p;
+        rotate_right(t, z);
+        p = z->rb_parent;
+      }
+      p->rb_color = RB_BLACK;
+      g->rb_color = RB_RED;
+      rotate_left(t, g);
+    }
+  }
+  t->root->rb_color = RB_BLACK;
+}
+
+struct pcb_t *rb_next(struct pcb_t *n) {
+  if (n->rb_right != NULL) {
+    n = n->rb_right;
+    while (n->rb_left != NULL)
+      n = n->rb_left;
+    return n;
+  }
+  while (n->rb_parent != NULL && n == n->rb_parent->rb_right)
+    n = n->rb_parent;
+  return n->rb_parent;
+}
+
+/* Put [v] where [u] hangs from its parent */
+static void transplant(struct rb_tree *t, struct pcb_t *u, struct pcb_t *v) {
+  if (u->rb_parent == NULL)
+    t->root = v;
+  else if (u == u->rb_parent->rb_left)
+    u->rb_parent->rb_left = v;
+  else
+    u->rb_parent->rb_right = v;
+  if (v != NULL)
+    v->rb_parent = u->rb_parent;
+}
+
+/* [x] (maybe NULL, below [parent]) is short of one black node */
+static void erase_fixup(struct rb_tree *t, struct pcb_t *x,
+                        struct pcb_t *parent) {
+  while (x != t->root && !IS_RED(x)) {
+    if (x == parent->rb_left) {
+      struct pcb_t *w = parent->rb_right;
+      if (IS_RED(w)) {
+        w->rb_color = RB_BLACK;
+        parent->rb_color = RB_RED;
+        rotate_left(t, parent);
+        w = parent->rb_right;
+      }
+      if (!IS_RED(w->rb_left) && !IS_RED(w->rb_right)) {
+        w->rb_color = RB_RED;
+        x = parent;
+        parent = x->rb_parent;
+        continue;
+      }
+      if (!IS_RED(w->rb_right)) {
+        w->rb_left->rb_color = RB_BLACK;
+        w->rb_color = RB_RED;
+        rotate_right(t, w);
+        w = parent->rb_right;
+      }
+      w->rb_color = parent->rb_color;
+      parent->rb_color = RB_BLACK;
+      w->rb_right->rb_color = RB_BLACK;
+      rotate_left(t, parent);
+    } else {
+      struct pcb_t *w = parent->rb_left;
+      if (IS_RED(w)) {
+        w->rb_color = RB_BLACK;
+        parent->rb_color = RB_RED;
+        rotate_right(t, parent);
+        w = parent->rb_left;
+      }
+      if (!IS_RED(w->rb_left) && !IS_RED(w->rb_right)) {
+        w->rb_color = RB_RED;
+        x = parent;
+        parent = x->rb_parent;
+        continue;
+      }
+      if (!IS_RED(w->rb_left)) {
+        w->rb_right->rb_color = RB_BLACK;
+        w->rb_color = RB_RED;
+        rotate_left(t, w);
+        w = parent->rb_left;
+      }
+      w->rb_color = parent->rb_color;
+      parent->rb_color = RB_BLACK;
+      w->rb_left->rb_color = RB_BLACK;
+      rotate_right(t, parent);
+    }
+    x = t->root;
+  }
+  if (x != NULL)
+    x->rb_color = RB_BLACK;
+}
+
+void rb_erase(struct rb_tree *t, struct pcb_t *z) {
+  if (t->leftmost == z)
+    t->leftmost = rb_next(z);
+
+  struct pcb_t *y = z, *x, *x_parent;
+  int y_color = y->rb_color;
+  if (z->rb_left == NULL) {
+    x = z->rb_right;
+    x_parent = z->rb_parent;
+    transplant(t, z, z->rb_right);
+  } else if (z->rb_right == NULL) {
+    x = z->rb_left;
+    x_parent = z->rb_parent;
+    transplant(t, z, z->rb_left);
+  } else {
+    /* Replace z with its successor */
+    y = z->rb_right;
+    while (y->rb_left != NULL)
+      y = y->rb_left;
+    y_color = y->rb_color;
+    x = y->rb_right;
+    if (y->rb_parent == z) {
+      x_parent = y;
+    } else {
+      x_parent = y->rb_parent;
+      transplant(t, y, y->rb_right);
+      y->rb_right = z->rb_right;
+      y->rb_right->rb_parent = y;
+    }
+    transplant(t, z, y);
+    y->rb_left = z->rb_left;
+    y->rb_left->rb_parent = y;
+    y->rb_color = z->rb_color;
+  }
+  if (y_color == RB_BLACK)
+    erase_fixup(t, x, x_parent);
+  t->size--;
+
+  z->rb_parent = NULL;
+  z->rb_left = NULL;
+  z->rb_right = NULL;
+}
@@ -0,0 +1,695 @@
+/*
+ * Scheduling policies
+ *  What each policy keeps in a run queue and how it picks the next
+ *  process from it, see struct sched_class. Everything here runs with the
+ *  lock of the run queue held.
+ */
+
+#include "queue.h"
+#include "rbtree.h"
+#include "sched.h"
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Weight of nice -20 .. 19 (as in Linux, one level is about 10% of the
+ * CPU), the priorities 0 .. MAX_PRIO - 1 are spread over the 40 levels.
+ * CFS weights, stride and lottery tickets all come from here */
+#define NICE_0_LOAD 1024
+static const uint32_t prio_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15};
+
+static uint64_t proc_weight(struct pcb_t *proc) {
+  return prio_to_weight[proc->prio * 40 / MAX_PRIO];
+}
+
+/* Oldest process of [q], left in it */
+static struct pcb_t *queue_head(struct queue_t *q) {
+  return empty(q) ? NULL : q->proc[q->head];
+}
+
+static int fixed_slice(struct sim_ctx *ctx, struct cpu_rq *rq,
+                       struct pcb_t *proc) {
+  return ctx->time_slot;
+}
+
+/*
+ * FIFO: one queue in arrival order
+ */
+
+static void fifo_init(struct cpu_rq *rq, int cpu) {
+  init_queue(&rq->fifo_queue);
+}
+
+static void fifo_destroy(struct cpu_rq *rq) { free_queue(&rq->fifo_queue); }
+
+static void fifo_enqueue(struct cpu_rq *rq, struct pcb_t *proc) {
+  enqueue(&rq->fifo_queue, proc);
+}
+
+static struct pcb_t *fifo_pick(struct cpu_rq *rq, int steal) {
+  return dequeue(&rq->fifo_queue);
+}
+
+static struct pcb_t *fifo_peek(struct cpu_rq *rq) {
+  return queue_head(&rq->fifo_queue);
+}
+
+static const struct sched_class fifo_class = {
+    .name = "fifo",
+    .init = fifo_init,
+    .destroy = fifo_destroy,
+    .enqueue = fifo_enqueue,
+    .pick = fifo_pick,
+    .peek = fifo_peek,
+    .slice = fixed_slice,
+};
+
+/*
+ * MLQ: one queue per priority, the highest priority first. A priority
+ * can have at most MAX_PRIO - prio of its processes running on this CPU
+ * at once (cpuRemainder).
+ */
+
+/* Bring the bitmap bits of [prio] up to date after its queue or its
+ * cpuRemainder changed */
+static void mlq_update(struct cpu_rq *rq, int prio) {
+  struct queue_t *q = &rq->mlq_ready_queue[prio];
+  if (empty(q)) {
+    clear_bit(prio, rq->mlq_nonempty);
+    clear_bit(prio, rq->mlq_ready);
+    return;
+  }
+  set_bit(prio, rq->mlq_nonempty);
+  if (q->cpuRemainder > 0)
+    set_bit(prio, rq->mlq_ready);
+  else
+    clear_bit(prio, rq->mlq_ready);
+}
+
+static void mlq_init(struct cpu_rq *rq, int cpu) {
+  int prio;
+  for (prio = 0; prio < MAX_PRIO; prio++) {
+    init_queue(&rq->mlq_ready_queue[prio]);
+    // init number of cpu each queue can use maximally
+    rq->mlq_ready_queue[prio].cpuRemainder = MAX_PRIO - prio;
+  }
+  for (prio = 0; prio < (int)BITS_TO_LONGS(MAX_PRIO); prio++) {
+    rq->mlq_nonempty[prio] = 0;
+    rq->mlq_ready[prio] = 0;
+  }
+}
+
+static void mlq_destroy(struct cpu_rq *rq) {
+  int prio;
+  for (prio = 0; prio < MAX_PRIO; prio++)
+    free_queue(&rq->mlq_ready_queue[prio]);
+}
+
+static void mlq_enqueue(struct cpu_rq *rq, struct pcb_t *proc) {
+  enqueue(&rq->mlq_ready_queue[proc->prio], proc);
+  mlq_update(rq, proc->prio);
+}
+
+/* A thief has all of its cpuRemainder left, it may take any priority */
+static struct pcb_t *mlq_pick(struct cpu_rq *rq, int steal) {
+  // the highest priority queue that has a process and still has slot
+  int prio = find_first_bit(steal ? rq->mlq_nonempty : rq->mlq_ready,
+                            MAX_PRIO);
+  if (prio == MAX_PRIO)
+    return NULL;
+  struct pcb_t *proc = dequeue(&rq->mlq_ready_queue[prio]);
+  mlq_update(rq, prio);
+  return proc;
+}
+
+static struct pcb_t *mlq_peek(struct cpu_rq *rq) {
+  int prio = find_first_bit(rq->mlq_nonempty, MAX_PRIO);
+  return prio == MAX_PRIO ? NULL : queue_head(&rq->mlq_ready_queue[prio]);
+}
+
+static void mlq_start(struct cpu_rq *rq, struct pcb_t *proc) {
+  // decrease cpuRemainder
+  rq->mlq_ready_queue[proc->prio].cpuRemainder--;
+  mlq_update(rq, proc->prio);
+}
+
+static void mlq_stop(struct cpu_rq *rq, struct pcb_t *proc, uint64_t ran) {
+  // increase cpuRemainder
+  rq->mlq_ready_queue[proc->prio].cpuRemainder++;
+  mlq_update(rq, proc->prio);
+}
+
+/* A lower priority number runs first */
+static uint64_t mlq_rank(struct pcb_t *proc) { return proc->prio; }
+
+static const struct sched_class mlq_class = {
+    .name = "mlq",
+    .init = mlq_init,
+    .destroy = mlq_destroy,
+    .enqueue = mlq_enqueue,
+    .pick = mlq_pick,
+    .peek = mlq_peek,
+    .start = mlq_start,
+    .stop = mlq_stop,
+    .slice = fixed_slice,
+    .rank = mlq_rank,
+};
+
+/*
+ * Virtual time (CFS and stride): the process that has had the least CPU
+ * for its weight runs first. Running one slot adds
+ * VT_SLOT / weight to its virtual time (for stride: the stride, with
+ * VT_SLOT as stride1 and the weight as tickets). A process joining a run
+ * queue starts from its min_vruntime, one leaving it keeps its lead.
+ */
+
+#define VT_SLOT ((uint64_t)NICE_0_LOAD << 10)
+
+/* Move min_vruntime forward to the smallest virtual time running or
+ * queued */
+static void vt_update_min(struct cpu_rq *rq) {
+  uint64_t vruntime = UINT64_MAX;
+  struct pcb_t *first = rb_first(&rq->vt_tree);
+  if (first != NULL)
+    vruntime = first->vruntime;
+  if (rq->curr && rq->curr_vruntime < vruntime)
+    vruntime = rq->curr_vruntime;
+  if (vruntime != UINT64_MAX && vruntime > rq->min_vruntime)
+    rq->min_vruntime = vruntime;
+}
+
+static void vt_init(struct cpu_rq *rq, int cpu) {
+  rb_init(&rq->vt_tree);
+  rq->vt_load = 0;
+  rq->min_vruntime = 0;
+  rq->curr_vruntime = 0;
+}
+
+static void vt_enqueue(struct cpu_rq *rq, struct pcb_t *proc) {
+  proc->rb_key = proc->vruntime;
+  rb_insert(&rq->vt_tree, proc);
+  rq->vt_load += proc_weight(proc);
+  vt_update_min(rq);
+}
+
+static struct pcb_t *vt_pick(struct cpu_rq *rq, int steal) {
+  struct pcb_t *proc = rb_first(&rq->vt_tree);
+  if (proc == NULL)
+    return NULL;
+  rb_erase(&rq->vt_tree, proc);
+  rq->vt_load -= proc_weight(proc);
+  return proc;
+}
+
+static struct pcb_t *vt_peek(struct cpu_rq *rq) {
+  return rb_first(&rq->vt_tree);
+}
+
+/* rq->curr is already set */
+static void vt_start(struct cpu_rq *rq, struct pcb_t *proc) {
+  rq->curr_vruntime = proc->vruntime;
+  vt_update_min(rq);
+}
+
+static void vt_stop(struct cpu_rq *rq, struct pcb_t *proc, uint64_t ran) {
+  proc->vruntime += ran * VT_SLOT / proc_weight(proc);
+  vt_update_min(rq);
+}
+
+static void vt_detach(struct cpu_rq *rq, struct pcb_t *proc) {
+  proc->vruntime = proc->vruntime > rq->min_vruntime
+                       ? proc->vruntime - rq->min_vruntime
+                       : 0;
+  vt_update_min(rq);
+}
+
+static void vt_attach(struct cpu_rq *rq, struct pcb_t *proc) {
+  proc->vruntime += rq->min_vruntime;
+}
+
+/* Share of the target latency by weight, against everything runnable on
+ * this CPU, but at least the minimum granularity */
+static int cfs_slice(struct sim_ctx *ctx, struct cpu_rq *rq,
+                     struct pcb_t *proc) {
+  uint64_t weight = proc_weight(proc);
+  uint64_t load = rq->vt_load + weight;
+  uint64_t nr_running = rq->vt_tree.size + 1;
+  uint64_t period = ctx->cfs_latency;
+  if (nr_running * ctx->cfs_min_gran > period)
+    period = nr_running * ctx->cfs_min_gran;
+  uint64_t slice = period * weight / load;
+  return slice < (uint64_t)ctx->cfs_min_gran ? ctx->cfs_min_gran : (int)slice;
+}
+
+static const struct sched_class cfs_class = {
+    .name = "cfs",
+    .init = vt_init,
+    .enqueue = vt_enqueue,
+    .pick = vt_pick,
+    .peek = vt_peek,
+    .start = vt_start,
+    .stop = vt_stop,
+    .detach = vt_detach,
+    .attach = vt_attach,
+    .slice = cfs_slice,
+};
+
+/* Stride shares the tree of CFS, with a fixed quantum */
+static const struct sched_class stride_class = {
+    .name = "stride",
+    .init = vt_init,
+    .enqueue = vt_enqueue,
+    .pick = vt_pick,
+    .peek = vt_peek,
+    .start = vt_start,
+    .stop = vt_stop,
+    .detach = vt_detach,
+    .attach = vt_attach,
+    .slice = fixed_slice,
+};
+
+/*
+ * Group: two levels of virtual time. The group that has had the least of
+ * this CPU for its shares runs first, from a min-heap of the groups with
+ * queued processes, and inside it the process with the least virtual
+ * time, from its own tree. Running one slot adds VT_SLOT / shares to the
+ * group and VT_SLOT / weight to the process, so a group gets its share of
+ * the CPU however many processes it has. Both picks are O(log n). A
+ * group out of quota leaves the heap with its tree until it is back.
+ */
+
+static int grp_before(struct cpu_rq *rq, int a, int b) {
+  if (rq->grp[a].vruntime != rq->grp[b].vruntime)
+    return rq->grp[a].vruntime < rq->grp[b].vruntime;
+  return a < b;
+}
+
+static void grp_set(struct cpu_rq *rq, int i, int g) {
+  rq->grp_heap[i] = g;
+  rq->grp[g].heap_index = i;
+}
+
+static void grp_sift_up(struct cpu_rq *rq, int i) {
+  int g = rq->grp_heap[i];
+  while (i > 0 && grp_before(rq, g, rq->grp_heap[(i - 1) / 2])) {
+    grp_set(rq, i, rq->grp_heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  grp_set(rq, i, g);
+}
+
+static void grp_sift_down(struct cpu_rq *rq, int i) {
+  int g = rq->grp_heap[i];
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= rq->grp_nr)
+      break;
+    if (child + 1 < rq->grp_nr &&
+        grp_before(rq, rq->grp_heap[child + 1], rq->grp_heap[child]))
+      child++;
+    if (!grp_before(rq, rq->grp_heap[child], g))
+      break;
+    grp_set(rq, i, rq->grp_heap[child]);
+    i = child;
+  }
+  grp_set(rq, i, g);
+}
+
+/* Move the floors forward: of the groups to the smallest group virtual
+ * time running or queued, of group [g] to that of its processes */
+static void grp_update_min(struct cpu_rq *rq, int g) {
+  uint64_t vruntime = UINT64_MAX;
+  if (rq->grp_nr > 0)
+    vruntime = rq->grp[rq->grp_heap[0]].vruntime;
+  if (rq->grp_curr >= 0 && rq->grp[rq->grp_curr].vruntime < vruntime)
+    vruntime = rq->grp[rq->grp_curr].vruntime;
+  if (vruntime != UINT64_MAX && vruntime > rq->grp_min_vruntime)
+    rq->grp_min_vruntime = vruntime;
+
+  struct grp_rq *gr = &rq->grp[g];
+  vruntime = UINT64_MAX;
+  struct pcb_t *first = rb_first(&gr->tree);
+  if (first != NULL)
+    vruntime = first->vruntime;
+  if (rq->grp_curr == g && rq->curr_vruntime < vruntime)
+    vruntime = rq->curr_vruntime;
+  if (vruntime != UINT64_MAX && vruntime > gr->min_vruntime)
+    gr->min_vruntime = vruntime;
+}
+
+static void grp_init(struct cpu_rq *rq, int cpu) {
+  int g;
+  for (g = 0; g < GROUP_MAX; g++) {
+    rb_init(&rq->grp[g].tree);
+    rq->grp[g].vruntime = 0;
+    rq->grp[g].min_vruntime = 0;
+    rq->grp[g].heap_index = -1;
+    rq->grp[g].throttled = 0;
+  }
+  rq->grp_nr = 0;
+  rq->grp_min_vruntime = 0;
+  rq->grp_curr = -1;
+}
+
+/* Put group [g], which has queued processes, in the heap */
+static void grp_push(struct cpu_rq *rq, int g) {
+  struct grp_rq *gr = &rq->grp[g];
+  /* No credit for the time it had nothing to run */
+  if (gr->vruntime < rq->grp_min_vruntime)
+    gr->vruntime = rq->grp_min_vruntime;
+  grp_set(rq, rq->grp_nr++, g);
+  grp_sift_up(rq, gr->heap_index);
+}
+
+/* Take group [g] out of the heap, the last group takes its place */
+static void grp_remove(struct cpu_rq *rq, int g) {
+  int i = rq->grp[g].heap_index;
+  rq->grp[g].heap_index = -1;
+  if (--rq->grp_nr == i)
+    return;
+  int last = rq->grp_heap[rq->grp_nr];
+  grp_set(rq, i, last);
+  /* Either way, whichever it needs */
+  grp_sift_up(rq, i);
+  grp_sift_down(rq, rq->grp[last].heap_index);
+}
+
+static void grp_enqueue(struct cpu_rq *rq, struct pcb_t *proc) {
+  int g = proc->group;
+  struct grp_rq *gr = &rq->grp[g];
+  proc->rb_key = proc->vruntime;
+  rb_insert(&gr->tree, proc);
+  if (gr->heap_index < 0 && !gr->throttled)
+    grp_push(rq, g);
+  grp_update_min(rq, g);
+}
+
+static struct pcb_t *grp_pick(struct cpu_rq *rq, int steal) {
+  if (rq->grp_nr == 0)
+    return NULL;
+  int g = rq->grp_heap[0];
+  struct grp_rq *gr = &rq->grp[g];
+  struct pcb_t *proc = rb_first(&gr->tree);
+  rb_erase(&gr->tree, proc);
+  if (gr->tree.size == 0)
+    grp_remove(rq, g);
+  return proc;
+}
+
+static struct pcb_t *grp_peek(struct cpu_rq *rq) {
+  return rq->grp_nr ? rb_first(&rq->grp[rq->grp_heap[0]].tree) : NULL;
+}
+
+static void grp_start(struct cpu_rq *rq, struct pcb_t *proc) {
+  rq->grp_curr = proc->group;
+  rq->curr_vruntime = proc->vruntime;
+  grp_update_min(rq, proc->group);
+}
+
+static void grp_stop(struct cpu_rq *rq, struct pcb_t *proc, uint64_t ran) {
+  int g = proc->group;
+  struct grp_rq *gr = &rq->grp[g];
+  proc->vruntime += ran * VT_SLOT / proc_weight(proc);
+  gr->vruntime += ran * VT_SLOT / rq->groups[g].shares;
+  /* Its key only grew */
+  if (gr->heap_index >= 0)
+    grp_sift_down(rq, gr->heap_index);
+  rq->grp_curr = -1;
+  grp_update_min(rq, g);
+}
+
+/* A process keeps its lead inside its group, the group itself starts
+ * over on every CPU */
+static void grp_detach(struct cpu_rq *rq, struct pcb_t *proc) {
+  struct grp_rq *gr = &rq->grp[proc->group];
+  proc->vruntime = proc->vruntime > gr->min_vruntime
+                       ? proc->vruntime - gr->min_vruntime
+                       : 0;
+}
+
+static void grp_attach(struct cpu_rq *rq, struct pcb_t *proc) {
+  proc->vruntime += rq->grp[proc->group].min_vruntime;
+}
+
+static int grp_throttle(struct cpu_rq *rq, int g) {
+  struct grp_rq *gr = &rq->grp[g];
+  if (gr->heap_index >= 0)
+    grp_remove(rq, g);
+  gr->throttled = 1;
+  return gr->tree.size;
+}
+
+static int grp_unthrottle(struct cpu_rq *rq, int g) {
+  struct grp_rq *gr = &rq->grp[g];
+  gr->throttled = 0;
+  if (gr->tree.size > 0)
+    grp_push(rq, g);
+  return gr->tree.size;
+}
+
+static const struct sched_class group_class = {
+    .name = "group",
+    .init = grp_init,
+    .enqueue = grp_enqueue,
+    .pick = grp_pick,
+    .peek = grp_peek,
+    .start = grp_start,
+    .stop = grp_stop,
+    .detach = grp_detach,
+    .attach = grp_attach,
+    .slice = fixed_slice,
+    .throttle = grp_throttle,
+    .unthrottle = grp_unthrottle,
+};
+
+/*
+ * Lottery: every slice goes to a process drawn at random, with a chance
+ * of its tickets over all queued tickets. The draw walks a Fenwick tree
+ * over the tickets of lot_procs, a process leaves by swapping in the last
+ * one, so both are O(log n).
+ */
+
+static void lot_add(struct cpu_rq *rq, int i, int64_t delta) {
+  for (i++; i <= rq->lot_cap; i += i & -i)
+    rq->lot_tickets[i - 1] += delta;
+}
+
+/* Double the arrays, the Fenwick tree is rebuilt for the new size */
+static void lot_grow(struct cpu_rq *rq) {
+  int n = rq->lot_nr;
+  int cap = rq->lot_cap ? 2 * rq->lot_cap : QUEUE_INIT_SIZE;
+  rq->lot_procs =
+      (struct pcb_t **)realloc(rq->lot_procs, cap * sizeof(struct pcb_t *));
+  rq->lot_tickets = (uint64_t *)realloc(rq->lot_tickets, cap * sizeof(uint64_t));
+  if (rq->lot_procs == NULL || rq->lot_tickets == NULL) {
+    fprintf(stderr, "Out of memory growing a lottery to %d entries\n", cap);
+    abort();
+  }
+  rq->lot_cap = cap;
+  memset(rq->lot_tickets, 0, cap * sizeof(uint64_t));
+  int i;
+  for (i = 0; i < n; i++)
+    lot_add(rq, i, proc_weight(rq->lot_procs[i]));
+}
+
+static void lot_init(struct cpu_rq *rq, int cpu) {
+  rq->lot_procs = NULL;
+  rq->lot_tickets = NULL;
+  rq->lot_cap = 0;
+  rq->lot_nr = 0;
+  rq->lot_total = 0;
+  /* Fixed per CPU, so a sequential run draws the same every time */
+  rq->lot_seed = 0x9e3779b97f4a7c15ULL * (cpu + 1);
+}
+
+static void lot_destroy(struct cpu_rq *rq) {
+  free(rq->lot_procs);
+  free(rq->lot_tickets);
+  rq->lot_procs = NULL;
+  rq->lot_tickets = NULL;
+  rq->lot_cap = 0;
+}
+
+static void lot_enqueue(struct cpu_rq *rq, struct pcb_t *proc) {
+  int i = rq->lot_nr;
+  if (i == rq->lot_cap)
+    lot_grow(rq);
+  rq->lot_nr++;
+  rq->lot_procs[i] = proc;
+  proc->lot_index = i;
+  lot_add(rq, i, proc_weight(proc));
+  rq->lot_total += proc_weight(proc);
+}
+
+/* xorshift64* */
+static uint64_t lot_random(struct cpu_rq *rq) {
+  uint64_t x = rq->lot_seed;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rq->lot_seed = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* Index of the first entry whose running ticket sum passes [draw] */
+static int lot_find(struct cpu_rq *rq, uint64_t draw) {
+  int pos = 0, step;
+  for (step = 1; step * 2 <= rq->lot_cap; step *= 2)
+    ;
+  for (; step > 0; step /= 2) {
+    if (pos + step <= rq->lot_cap && rq->lot_tickets[pos + step - 1] <= draw) {
+      pos += step;
+      draw -= rq->lot_tickets[pos - 1];
+    }
+  }
+  return pos;
+}
+
+/* A thief gets no draw, it takes the first entry */
+static struct pcb_t *lot_pick(struct cpu_rq *rq, int steal) {
+  int n = rq->lot_nr;
+  if (n == 0)
+    return NULL;
+  int pos = steal ? 0 : lot_find(rq, lot_random(rq) % rq->lot_total);
+  struct pcb_t *proc = rq->lot_procs[pos];
+
+  /* Fill the hole with the last process */
+  uint64_t weight = proc_weight(proc);
+  struct pcb_t *last = rq->lot_procs[n - 1];
+  if (last != proc) {
+    uint64_t last_weight = proc_weight(last);
+    lot_add(rq, pos, (int64_t)last_weight - (int64_t)weight);
+    lot_add(rq, n - 1, -(int64_t)last_weight);
+    rq->lot_procs[pos] = last;
+    last->lot_index = pos;
+  } else {
+    lot_add(rq, pos, -(int64_t)weight);
+  }
+  rq->lot_procs[n - 1] = NULL;
+  rq->lot_nr--;
+  rq->lot_total -= weight;
+  return proc;
+}
+
+static struct pcb_t *lot_peek(struct cpu_rq *rq) {
+  return rq->lot_nr ? rq->lot_procs[0] : NULL;
+}
+
+static const struct sched_class lottery_class = {
+    .name = "lottery",
+    .init = lot_init,
+    .destroy = lot_destroy,
+    .enqueue = lot_enqueue,
+    .pick = lot_pick,
+    .peek = lot_peek,
+    .slice = fixed_slice,
+};
+
+/*
+ * EDF: the process with the earliest absolute deadline first, from a
+ * binary min-heap (the lower pid on a tie). Not a policy of its own, it
+ * runs ahead of the policy for the processes admitted with a deadline.
+ */
+
+static int dl_before(struct pcb_t *a, struct pcb_t *b) {
+  if (a->dl_deadline != b->dl_deadline)
+    return a->dl_deadline < b->dl_deadline;
+  return a->pid < b->pid;
+}
+
+static void dl_init(struct cpu_rq *rq, int cpu) {
+  rq->dl_heap = NULL;
+  rq->dl_size = 0;
+  rq->dl_cap = 0;
+  rq->dl_util = 0;
+}
+
+static void dl_destroy(struct cpu_rq *rq) {
+  free(rq->dl_heap);
+  rq->dl_heap = NULL;
+  rq->dl_cap = 0;
+}
+
+static void dl_enqueue(struct cpu_rq *rq, struct pcb_t *proc) {
+  if (rq->dl_size == rq->dl_cap) {
+    int cap = rq->dl_cap ? 2 * rq->dl_cap : QUEUE_INIT_SIZE;
+    rq->dl_heap =
+        (struct pcb_t **)realloc(rq->dl_heap, cap * sizeof(struct pcb_t *));
+    if (rq->dl_heap == NULL) {
+      fprintf(stderr, "Out of memory growing a deadline heap to %d entries\n",
+              cap);
+      abort();
+    }
+    rq->dl_cap = cap;
+  }
+  /* Sift up */
+  int i = rq->dl_size++;
+  while (i > 0 && dl_before(proc, rq->dl_heap[(i - 1) / 2])) {
+    rq->dl_heap[i] = rq->dl_heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  rq->dl_heap[i] = proc;
+}
+
+static struct pcb_t *dl_pick(struct cpu_rq *rq, int steal) {
+  if (rq->dl_size == 0)
+    return NULL;
+  struct pcb_t *proc = rq->dl_heap[0];
+  struct pcb_t *last = rq->dl_heap[--rq->dl_size];
+  rq->dl_heap[rq->dl_size] = NULL;
+  if (rq->dl_size == 0)
+    return proc;
+  /* Sift the last one down from the root */
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= rq->dl_size)
+      break;
+    if (child + 1 < rq->dl_size &&
+        dl_before(rq->dl_heap[child + 1], rq->dl_heap[child]))
+      child++;
+    if (!dl_before(rq->dl_heap[child], last))
+      break;
+    rq->dl_heap[i] = rq->dl_heap[child];
+    i = child;
+  }
+  rq->dl_heap[i] = last;
+  return proc;
+}
+
+static struct pcb_t *dl_peek(struct cpu_rq *rq) {
+  return rq->dl_size ? rq->dl_heap[0] : NULL;
+}
+
+static uint64_t dl_rank(struct pcb_t *proc) { return proc->dl_deadline; }
+
+const struct sched_class edf_class = {
+    .name = "edf",
+    .init = dl_init,
+    .destroy = dl_destroy,
+    .enqueue = dl_enqueue,
+    .pick = dl_pick,
+    .peek = dl_peek,
+    .slice = fixed_slice,
+    .rank = dl_rank,
+};
+
+const struct sched_class *const sched_classes[NUM_POLICIES] = {
+    [POLICY_MLQ] = &mlq_class,       [POLICY_CFS] = &cfs_class,
+    [POLICY_FIFO] = &fifo_class,     [POLICY_STRIDE] = &stride_class,
+    [POLICY_LOTTERY] = &lottery_class, [POLICY_GROUP] = &group_class,
+};
+
+int sched_policy_by_name(const char *name) {
+  int i;
+  for (i = 0; i < NUM_POLICIES; i++) {
+    if (strcmp(sched_classes[i]->name, name) == 0)
+      return i;
+  }
+  return -1;
+}
@@ -1,121 +1,737 @@
 
+#include "group.h"
 #include "queue.h"
 #include "sched.h"
+#include "sim.h"
+#include "stats.h"
 
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static struct queue_t ready_queue;
-static struct queue_t run_queue;
+/* Take the lock of [rq], counting the times another thread had it */
+static void rq_lock(struct cpu_rq *rq) {
+  if (pthread_mutex_trylock(&rq->lock) != 0) {
+    pthread_mutex_lock(&rq->lock);
+    rq->contended++;
+  }
+}
+
+static void rq_unlock(struct cpu_rq *rq) { pthread_mutex_unlock(&rq->lock); }
+
+/* Processes queued on or running on the CPU of [rq] */
+static int rq_load(struct cpu_rq *rq) {
+  return __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED) +
+         __atomic_load_n(&rq->curr, __ATOMIC_RELAXED);
+}
+
+/* Policy of the simulation */
+static const struct sched_class *policy(struct sim_ctx *ctx) {
+  return sched_classes[ctx->policy];
+}
+
+/* Class [proc] is scheduled by: EDF if it was admitted with a deadline */
+static const struct sched_class *class_of(struct sim_ctx *ctx,
+                                          struct pcb_t *proc) {
+  return proc->dl_util ? &edf_class : policy(ctx);
+}
+
+/* Preemption rank of [proc]: EDF processes (deadlines, far below bit 63)
+ * outrank every process of the policy, ranked by it above bit 63, and a
+ * policy without rank is never preempted */
+static uint64_t rank_of(struct sim_ctx *ctx, struct pcb_t *proc) {
+  const struct sched_class *class = class_of(ctx, proc);
+  if (class->rank == NULL)
+    return UINT64_MAX;
+  uint64_t rank = class->rank(proc);
+  return class == &edf_class ? rank : (uint64_t)1 << 63 | rank;
+}
+
+/* Queue [proc] on [rq], rq lock held */
+static void rq_enqueue(struct sim_ctx *ctx, struct cpu_rq *rq,
+                       struct pcb_t *proc) {
+  proc->stats.ready_since = current_time(&ctx->timer);
+  class_of(ctx, proc)->enqueue(rq, proc);
+  /* Counted once its group is back, see rq_unthrottle */
+  if (!proc->dl_util && test_bit(proc->group, rq->grp_throttled))
+    return;
+  /* Pairs with sched_park: either the parking CPU sees this process or
+   * we see it parked */
+  __atomic_store_n(&rq->nr_queued, rq->nr_queued + 1, __ATOMIC_SEQ_CST);
+}
 
-// Synchronization variables
-static pthread_mutex_t queue_lock;
+/* Take the process to run next off [rq], rq lock held. With [steal] it
+ * is for another CPU (MLQ then ignores cpuRemainder, which is that of the
+ * CPU of [rq]) */
+static struct pcb_t *rq_pick(struct sim_ctx *ctx, struct cpu_rq *rq,
+                             int steal) {
+  struct pcb_t *proc = edf_class.pick(rq, steal);
+  if (proc == NULL)
+    proc = policy(ctx)->pick(rq, steal);
+  if (proc != NULL)
+    __atomic_store_n(&rq->nr_queued, rq->nr_queued - 1, __ATOMIC_RELAXED);
+  return proc;
+}
 
-#ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
-#endif
+/* What rq_pick would take for another CPU, left queued */
+static struct pcb_t *rq_peek(struct sim_ctx *ctx, struct cpu_rq *rq) {
+  struct pcb_t *proc = edf_class.peek(rq);
+  return proc != NULL ? proc : policy(ctx)->peek(rq);
+}
+
+/* [proc], picked off [rq], moves to another CPU, rq lock held. An EDF
+ * process takes its CPU share along */
+static void rq_detach(struct sim_ctx *ctx, struct cpu_rq *rq,
+                      struct pcb_t *proc) {
+  if (proc->dl_util) {
+    __atomic_fetch_sub(&rq->dl_util, proc->dl_util, __ATOMIC_RELAXED);
+    proc->dl_cpu = -1;
+    return;
+  }
+  if (policy(ctx)->detach != NULL)
+    policy(ctx)->detach(rq, proc);
+}
+
+/* [proc] joins [rq] from elsewhere (or is new), rq lock held */
+static void rq_attach(struct sim_ctx *ctx, struct cpu_rq *rq,
+                      struct pcb_t *proc) {
+  if (proc->dl_util) {
+    /* Unless sched_admit reserved it here already */
+    if (proc->dl_cpu < 0) {
+      __atomic_fetch_add(&rq->dl_util, proc->dl_util, __ATOMIC_RELAXED);
+      proc->dl_cpu = rq - ctx->sched.rq;
+    }
+    return;
+  }
+  if (policy(ctx)->attach != NULL)
+    policy(ctx)->attach(rq, proc);
+}
+
+/* Give the groups parked on [rq] whose quota is back by [now] their
+ * picks again, rq lock held */
+static void rq_unthrottle(struct sim_ctx *ctx, struct cpu_rq *rq,
+                          uint64_t now) {
+  if (now < rq->grp_unthrottle)
+    return;
+  uint64_t next = UINT64_MAX;
+  int g;
+  for (g = 0; g < GROUP_MAX; g++) {
+    if (!test_bit(g, rq->grp_throttled))
+      continue;
+    if (rq->grp_until[g] > now) {
+      if (rq->grp_until[g] < next)
+        next = rq->grp_until[g];
+      continue;
+    }
+    clear_bit(g, rq->grp_throttled);
+    int n = policy(ctx)->unthrottle(rq, g);
+    __atomic_store_n(&rq->nr_queued, rq->nr_queued + n, __ATOMIC_SEQ_CST);
+    if (now != UINT64_MAX)
+      fprintf(ctx->out, "\tCPU %d: group %s unthrottled\n",
+              (int)(rq - ctx->sched.rq), ctx->groups[g].name);
+  }
+  rq->grp_unthrottle = next;
+}
+
+/* rq_pick for a process about to run. A group found out of quota is
+ * parked here with its queued processes until its next period, so the
+ * picks after it do not see it again */
+static struct pcb_t *rq_pick_quota(struct sim_ctx *ctx, struct cpu_rq *rq,
+                                   int steal) {
+  if (policy(ctx)->throttle == NULL)
+    return rq_pick(ctx, rq, steal);
+  rq_unthrottle(ctx, rq, current_time(&ctx->timer));
+  struct pcb_t *proc;
+  uint64_t until;
+  while ((proc = rq_pick(ctx, rq, steal)) != NULL && !proc->dl_util &&
+         !group_reserve(ctx, proc, &until)) {
+    int g = proc->group;
+    /* Back in its tree, it leaves nr_queued with the others */
+    policy(ctx)->enqueue(rq, proc);
+    int n = policy(ctx)->throttle(rq, g);
+    __atomic_store_n(&rq->nr_queued, rq->nr_queued + 1 - n, __ATOMIC_RELAXED);
+    set_bit(g, rq->grp_throttled);
+    rq->grp_until[g] = until;
+    if (until < rq->grp_unthrottle)
+      rq->grp_unthrottle = until;
+    fprintf(ctx->out, "\tCPU %d: group %s throttled until slot %lu\n",
+            (int)(rq - ctx->sched.rq), ctx->groups[g].name,
+            (unsigned long)until);
+  }
+  return proc;
+}
 
-int queue_empty(void) {
-#ifdef MLQ_SCHED
-  unsigned long prio;
-  for (prio = 0; prio < MAX_PRIO; prio++)
-    if (!empty(&mlq_ready_queue[prio])) return -1;
-#endif
-  return (empty(&ready_queue) && empty(&run_queue));
+/* The CPU of [rq] starts running [proc], rq lock held */
+static void rq_start(struct sim_ctx *ctx, struct cpu_rq *rq,
+                     struct pcb_t *proc) {
+  uint64_t now = current_time(&ctx->timer);
+  proc->exec_start = now;
+  proc->stats.wait += now - proc->stats.ready_since;
+  if (proc->stats.first_run == UINT64_MAX)
+    proc->stats.first_run = now;
+  proc->stats.switches++;
+  if (proc->last_cpu >= 0 && proc->last_cpu != rq - ctx->sched.rq)
+    proc->stats.migrations++;
+  __atomic_store_n(&rq->curr, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&rq->curr_rank, rank_of(ctx, proc), __ATOMIC_RELAXED);
+  __atomic_store_n(&rq->curr_tgid, proc->tgid, __ATOMIC_RELAXED);
+  if (class_of(ctx, proc)->start != NULL)
+    class_of(ctx, proc)->start(rq, proc);
 }
 
-void init_scheduler(void) {
-#ifdef MLQ_SCHED
+/* The CPU of [rq] stops running [proc], rq lock held */
+static void rq_stop(struct sim_ctx *ctx, struct cpu_rq *rq,
+                    struct pcb_t *proc) {
+  uint64_t now = current_time(&ctx->timer);
+  uint64_t ran = now - proc->exec_start;
+  proc->stats.run += ran;
+  proc->last_cpu = rq - ctx->sched.rq;
+  proc->last_ran = now;
+  __atomic_store_n(&rq->curr, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&rq->curr_tgid, 0, __ATOMIC_RELAXED);
+  if (class_of(ctx, proc)->stop != NULL)
+    class_of(ctx, proc)->stop(rq, proc, ran);
+  group_charge(ctx, proc, ran);
+}
+
+int queue_empty(struct sim_ctx *ctx) {
+  int i;
+  for (i = 0; i < ctx->max_cpus; i++)
+    if (__atomic_load_n(&ctx->sched.rq[i].nr_queued, __ATOMIC_RELAXED) > 0)
+      return 0;
+  return 1;
+}
+
+void init_scheduler(struct sim_ctx *ctx) {
+  struct sched_struct *sched = &ctx->sched;
+  int i;
+
+  /* sizeof(struct cpu_rq) is a whole number of cache lines */
+  sched->rq = (struct cpu_rq *)aligned_alloc(
+      CACHE_LINE_SIZE, ctx->max_cpus * sizeof(struct cpu_rq));
+  for (i = 0; i < ctx->max_cpus; i++) {
+    struct cpu_rq *rq = &sched->rq[i];
+    pthread_mutex_init(&rq->lock, NULL);
+    rq->groups = ctx->groups;
+    /* Every policy, os -P may still pick another one before the run */
+    int p;
+    for (p = 0; p < NUM_POLICIES; p++)
+      sched_classes[p]->init(rq, i);
+    edf_class.init(rq, i);
+    rq->nr_queued = 0;
+    rq->curr = 0;
+    rq->curr_rank = 0;
+    rq->curr_tgid = 0;
+    memset(rq->grp_throttled, 0, sizeof(rq->grp_throttled));
+    rq->grp_unthrottle = UINT64_MAX;
+    rq->contended = 0;
+    rq->migrations = 0;
+  }
+
+  pthread_mutex_init(&sched->queue_lock, NULL);
+  sched->parked = (int *)malloc(ctx->max_cpus * sizeof(int));
+  sched->parked_head = 0;
+  sched->num_parked = 0;
+}
+
+void finish_scheduler(struct sim_ctx *ctx) {
+  int i;
+  for (i = 0; i < ctx->max_cpus; i++) {
+    int p;
+    for (p = 0; p < NUM_POLICIES; p++) {
+      if (sched_classes[p]->destroy != NULL)
+        sched_classes[p]->destroy(&ctx->sched.rq[i]);
+    }
+    edf_class.destroy(&ctx->sched.rq[i]);
+    pthread_mutex_destroy(&ctx->sched.rq[i].lock);
+  }
+  free(ctx->sched.rq);
+  pthread_mutex_destroy(&ctx->sched.queue_lock);
+  free(ctx->sched.parked);
+}
+
+/* Whether get_proc could return a process to an idle CPU, queue_lock
+ * held. An idle CPU may steal, so any queued process will do. */
+static int runnable(struct sim_ctx *ctx) {
   int i;
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (__atomic_load_n(&ctx->sched.rq[i].nr_queued, __ATOMIC_SEQ_CST) > 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* Hand a slot barrier place back to a parked CPU, queue_lock held. In the
+ * single-threaded engine there is no barrier, the CPU is simply stepped
+ * again. */
+static void wake_cpu(struct cpu_args *cpu) {
+  __atomic_store_n(&cpu->parked, 0, __ATOMIC_RELEASE);
+  if (cpu->timer_id != NULL)
+    unpark_event(cpu->timer_id);
+}
 
-  for (i = 0; i < MAX_PRIO; i++) {
-    mlq_ready_queue[i].size = 0;
-    // init number of cpu each queue can use maximally
-    mlq_ready_queue[i].cpuRemainder = MAX_PRIO - i;
+/* Something may have become runnable, queue_lock held */
+static void wake_one(struct sim_ctx *ctx) {
+  struct sched_struct *sched = &ctx->sched;
+  if (sched->num_parked > 0) {
+    int id = sched->parked[sched->parked_head];
+    sched->parked_head = (sched->parked_head + 1) % ctx->max_cpus;
+    __atomic_store_n(&sched->num_parked, sched->num_parked - 1,
+                     __ATOMIC_RELAXED);
+    wake_cpu(&ctx->cpus[id]);
   }
+}
 
-#endif
-  ready_queue.size = 0;
-  run_queue.size = 0;
-  run_queue.cpuRemainder = MAX_PRIO;
-  pthread_mutex_init(&queue_lock, NULL);
+/* Take [cpu] out of the parked ring and wake it, queue_lock held. Return
+ * 0 if it was not parked */
+static int unpark_locked(struct sim_ctx *ctx, struct cpu_args *cpu) {
+  struct sched_struct *sched = &ctx->sched;
+  int i;
+  for (i = 0; i < sched->num_parked; i++) {
+    if (sched->parked[(sched->parked_head + i) % ctx->max_cpus] != cpu->id)
+      continue;
+    /* Close the gap */
+    for (; i < sched->num_parked - 1; i++)
+      sched->parked[(sched->parked_head + i) % ctx->max_cpus] =
+          sched->parked[(sched->parked_head + i + 1) % ctx->max_cpus];
+    __atomic_store_n(&sched->num_parked, sched->num_parked - 1,
+                     __ATOMIC_RELAXED);
+    wake_cpu(cpu);
+    return 1;
+  }
+  return 0;
+}
+
+/* A process was queued on CPU [target]: wake it if it is parked, or else
+ * the longest parked CPU, which will steal the process. Nothing to do
+ * (and no lock taken) while no CPU is parked. */
+static void kick(struct sim_ctx *ctx, int target) {
+  struct sched_struct *sched = &ctx->sched;
+  if (__atomic_load_n(&sched->num_parked, __ATOMIC_SEQ_CST) == 0)
+    return;
+  pthread_mutex_lock(&sched->queue_lock);
+  if (target < 0 || !unpark_locked(ctx, &ctx->cpus[target]))
+    wake_one(ctx);
+  pthread_mutex_unlock(&sched->queue_lock);
+}
+
+int sched_finished(struct sim_ctx *ctx) {
+  if (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE))
+    return 0;
+  /* Finished first: a process that finished after waking another one
+   * took it off the waiters before */
+  int finished = __atomic_load_n(&ctx->nr_finished, __ATOMIC_SEQ_CST);
+  int blocked = __atomic_load_n(&ctx->nr_blocked, __ATOMIC_SEQ_CST);
+  /* Threads last: one spawned before its process blocked is counted */
+  int threads = __atomic_load_n(&ctx->nr_threads, __ATOMIC_SEQ_CST);
+  return blocked == ctx->num_processes + threads - finished;
+}
+
+int sched_done(struct sim_ctx *ctx) {
+  if (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE) ||
+      __atomic_load_n(&ctx->nr_draining, __ATOMIC_ACQUIRE) != 0 ||
+      __atomic_load_n(&ctx->nr_io, __ATOMIC_SEQ_CST) != 0)
+    return 0;
+  return __atomic_load_n(&ctx->nr_blocked, __ATOMIC_SEQ_CST) == 0 ||
+         sched_finished(ctx);
+}
+
+int sched_park(struct sim_ctx *ctx, struct cpu_args *cpu) {
+  struct sched_struct *sched = &ctx->sched;
+  pthread_mutex_lock(&sched->queue_lock);
+  /* done (or the last block or finish) is written before the lock is
+   * taken in sched_wake_all, so either we see it here or it sees us
+   * parked */
+  if (sched_done(ctx)) {
+    pthread_mutex_unlock(&sched->queue_lock);
+    return 0;
+  }
+  /* Show up as parked before looking at the run queues, see rq_enqueue */
+  sched->parked[(sched->parked_head + sched->num_parked) % ctx->max_cpus] =
+      cpu->id;
+  __atomic_store_n(&sched->num_parked, sched->num_parked + 1,
+                   __ATOMIC_SEQ_CST);
+  if (runnable(ctx)) {
+    __atomic_store_n(&sched->num_parked, sched->num_parked - 1,
+                     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&sched->queue_lock);
+    return 0;
+  }
+  if (cpu->timer_id != NULL)
+    park_prepare(cpu->timer_id);
+  __atomic_store_n(&cpu->parked, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&sched->queue_lock);
+  return 1;
+}
+
+void sched_unpark(struct sim_ctx *ctx, struct cpu_args *cpu) {
+  pthread_mutex_lock(&ctx->sched.queue_lock);
+  unpark_locked(ctx, cpu);
+  pthread_mutex_unlock(&ctx->sched.queue_lock);
+}
+
+/* Bring the I/O controller back, queue_lock held */
+static void wake_io_locked(struct sim_ctx *ctx) {
+  struct io_ctl *ioc = &ctx->ioc;
+  if (!__atomic_load_n(&ioc->parked, __ATOMIC_RELAXED))
+    return;
+  __atomic_store_n(&ioc->parked, 0, __ATOMIC_RELEASE);
+  if (ioc->timer_id != NULL)
+    unpark_event(ioc->timer_id);
+}
+
+void sched_wake_all(struct sim_ctx *ctx) {
+  pthread_mutex_lock(&ctx->sched.queue_lock);
+  while (ctx->sched.num_parked > 0)
+    wake_one(ctx);
+  wake_io_locked(ctx);
+  pthread_mutex_unlock(&ctx->sched.queue_lock);
+}
+
+int sched_park_io(struct sim_ctx *ctx) {
+  struct io_ctl *ioc = &ctx->ioc;
+  pthread_mutex_lock(&ctx->sched.queue_lock);
+  if (sched_finished(ctx)) {
+    pthread_mutex_unlock(&ctx->sched.queue_lock);
+    return 0;
+  }
+  /* Show up as parked before looking for requests, see io_submit */
+  __atomic_store_n(&ioc->parked, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ctx->nr_io, __ATOMIC_SEQ_CST) > 0) {
+    __atomic_store_n(&ioc->parked, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->sched.queue_lock);
+    return 0;
+  }
+  if (ioc->timer_id != NULL)
+    park_prepare(ioc->timer_id);
+  pthread_mutex_unlock(&ctx->sched.queue_lock);
+  return 1;
+}
+
+void sched_wake_io(struct sim_ctx *ctx) {
+  if (!__atomic_load_n(&ctx->ioc.parked, __ATOMIC_SEQ_CST))
+    return;
+  pthread_mutex_lock(&ctx->sched.queue_lock);
+  wake_io_locked(ctx);
+  pthread_mutex_unlock(&ctx->sched.queue_lock);
 }
 
-#ifdef MLQ_SCHED
 /*
  *  Stateful design for routine calling
  *  based on the priority and our MLQ policy
  *  We implement stateful here using transition technique
  *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO -
  * prio)
+ *
+ *  Every CPU keeps this state for its own queues: a CPU takes the
+ *  cpuRemainder of the priority it dispatches from its own queues, even
+ *  for a process it stole. The other policies are in sched-policy.c, all
+ *  of them go through the per-CPU run queues below.
  */
 
-struct pcb_t *get_mlq_proc(void) {
-  struct pcb_t *proc = NULL;
-  unsigned long curr_prio = 0, max_prio = MAX_PRIO;
-  // find the highest priority queue that has process
-  while (curr_prio < max_prio) {
-    // if there is a process in this queue and this queue still has slot
-    if (!empty(&mlq_ready_queue[curr_prio]) &&
-        mlq_ready_queue[curr_prio].cpuRemainder > 0) {
-      proc = dequeue(&mlq_ready_queue[curr_prio]);
-      if (proc != NULL) {
-        // decrease cpuRemainder
-        mlq_ready_queue[curr_prio].cpuRemainder--;
+/* The least loaded online CPU for [proc] (the first one on a tie), or the
+ * least loaded one at all while every CPU is offline */
+static int pick_cpu(struct sim_ctx *ctx, struct pcb_t *proc) {
+  int best = -1, best_load = 0;
+  int online_only;
+  for (online_only = 1; best < 0 && online_only >= 0; online_only--) {
+    int i;
+    for (i = 0; i < ctx->max_cpus; i++) {
+      if (online_only && __atomic_load_n(&ctx->cpus[i].state,
+                                         __ATOMIC_ACQUIRE) != CPU_ONLINE)
+        continue;
+      struct cpu_rq *rq = &ctx->sched.rq[i];
+      int load = rq_load(rq);
+      /* A CPU running a sibling thread counts one more, so the threads
+       * of a process spread over the CPUs */
+      if (__atomic_load_n(&rq->curr_tgid, __ATOMIC_RELAXED) == proc->tgid)
+        load++;
+      if (best < 0 || load < best_load) {
+        best = i;
+        best_load = load;
       }
+    }
+  }
+  return best;
+}
+
+/* The online CPU with the least EDF utilization admitted (the least
+ * loaded one on a tie), -1 if every CPU is offline */
+static int pick_dl_cpu(struct sim_ctx *ctx) {
+  int best = -1;
+  uint64_t best_util = 0;
+  int best_load = 0;
+  int i;
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (__atomic_load_n(&ctx->cpus[i].state, __ATOMIC_ACQUIRE) != CPU_ONLINE)
+      continue;
+    uint64_t util =
+        __atomic_load_n(&ctx->sched.rq[i].dl_util, __ATOMIC_RELAXED);
+    int load = rq_load(&ctx->sched.rq[i]);
+    if (best < 0 || util < best_util ||
+        (util == best_util && load < best_load)) {
+      best = i;
+      best_util = util;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+int sched_admit(struct sim_ctx *ctx, struct pcb_t *proc) {
+  proc->dl_util = 0;
+  proc->dl_cpu = -1;
+  if (proc->dl_rel == 0)
+    return -1;
+
+  /* One instruction per slot, for the whole program, within the
+   * deadline and within the period: U = C / min(D, T) */
+  uint64_t window = proc->dl_rel;
+  if (proc->dl_period != 0 && proc->dl_period < window)
+    window = proc->dl_period;
+  uint64_t util = (proc->code->size * DL_ONE + window - 1) / window;
+
+  /* Worst fit: if the emptiest CPU has no room, none has */
+  int cpu = -1;
+  while (util <= DL_ONE && (cpu = pick_dl_cpu(ctx)) >= 0) {
+    uint64_t *dl_util = &ctx->sched.rq[cpu].dl_util;
+    uint64_t old = __atomic_load_n(dl_util, __ATOMIC_RELAXED);
+    if (old + util > DL_ONE) {
+      cpu = -1;
       break;
-    } else {
-      // if there is no process in this queue or this queue has no slot
-      curr_prio++;
     }
+    if (__atomic_compare_exchange_n(dl_util, &old, old + util, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      break;
   }
-  return proc;
+  if (util > DL_ONE || cpu < 0) {
+    /* Runs under the policy instead */
+    proc->dl_rel = 0;
+    return -1;
+  }
+  proc->dl_util = util;
+  proc->dl_cpu = cpu;
+  proc->dl_deadline = current_time(&ctx->timer) + proc->dl_rel;
+  proc->stats.deadline = proc->dl_deadline;
+  return cpu;
+}
+
+/* The CPU among [target] (an EDF process stays on its share) or else
+ * every online CPU that runs the lowest ranked process, if new process
+ * [proc] outranks it; -1 if there is none */
+static int pick_preempt_cpu(struct sim_ctx *ctx, struct pcb_t *proc,
+                            int target) {
+  uint64_t rank = rank_of(ctx, proc);
+  int best = -1;
+  uint64_t best_rank = rank;
+  int i;
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (proc->dl_util ? i != target
+                      : __atomic_load_n(&ctx->cpus[i].state,
+                                        __ATOMIC_ACQUIRE) != CPU_ONLINE)
+      continue;
+    struct cpu_rq *rq = &ctx->sched.rq[i];
+    uint64_t curr_rank = __atomic_load_n(&rq->curr_rank, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&rq->curr, __ATOMIC_RELAXED) && curr_rank > best_rank) {
+      best = i;
+      best_rank = curr_rank;
+    }
+  }
+  return best;
 }
 
-void put_mlq_proc(struct pcb_t *proc) {
-  pthread_mutex_lock(&queue_lock);
-  enqueue(&mlq_ready_queue[proc->prio], proc);
-  // increase cpuRemainder
-  mlq_ready_queue[proc->prio].cpuRemainder++;
-  pthread_mutex_unlock(&queue_lock);
+/* Queue [proc] on the least loaded CPU, [migrated] if it comes from the
+ * queues of another CPU (and was detached from them). An EDF process goes
+ * where its share is, or else to the CPU with the least EDF utilization.
+ * A new process that finds its CPU busy may preempt, see add_proc */
+static void place_proc(struct sim_ctx *ctx, struct pcb_t *proc,
+                       int migrated) {
+  int target = proc->dl_cpu;
+  if (!proc->dl_util)
+    target = pick_cpu(ctx, proc);
+  else if (target < 0 && (target = pick_dl_cpu(ctx)) < 0)
+    target = pick_cpu(ctx, proc);
+  int victim = -1;
+  if (!migrated && ctx->preempt && rq_load(&ctx->sched.rq[target]) > 0)
+    victim = pick_preempt_cpu(ctx, proc, target);
+  if (victim >= 0)
+    target = victim;
+  struct cpu_rq *rq = &ctx->sched.rq[target];
+  rq_lock(rq);
+  rq_attach(ctx, rq, proc);
+  rq_enqueue(ctx, rq, proc);
+  rq->migrations += migrated;
+  /* Under the lock get_proc clears it with, so the CPU either picks the
+   * process now or sees the flag in its next slot. Rank 0 keeps the next
+   * new processes from picking the same CPU until it has switched */
+  if (victim >= 0 && __atomic_load_n(&rq->curr, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&rq->curr_rank, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->cpus[target].need_resched, 1, __ATOMIC_RELEASE);
+  }
+  rq_unlock(rq);
+  kick(ctx, target);
 }
 
-void add_mlq_proc(struct pcb_t *proc) {
-  pthread_mutex_lock(&queue_lock);
-  enqueue(&mlq_ready_queue[proc->prio], proc);
-  pthread_mutex_unlock(&queue_lock);
+/* Whether [proc], queued on CPU [victim], ran there within the affinity
+ * window and should rather wait for it, victim rq lock held */
+static int cache_hot(struct sim_ctx *ctx, int victim, struct pcb_t *proc) {
+  return proc->last_cpu == victim &&
+         current_time(&ctx->timer) - proc->last_ran <
+             (uint64_t)ctx->affinity_window;
 }
 
-struct pcb_t *get_proc(int decrSlotCpu) { return get_mlq_proc(); }
+/* Take the next process of the CPU with the most queued processes and
+ * start it on idle CPU [cpu]. CPUs whose next process is cache hot are
+ * left alone. */
+static struct pcb_t *steal(struct sim_ctx *ctx, int cpu) {
+  struct sched_struct *sched = &ctx->sched;
+  unsigned long hot[BITS_TO_LONGS(ctx->max_cpus)];
+  memset(hot, 0, sizeof(hot));
+  for (;;) {
+    int victim = -1, most = 0;
+    int i;
+    /* Start next to us so thieves spread over the victims */
+    for (i = 1; i < ctx->max_cpus; i++) {
+      int id = (cpu + i) % ctx->max_cpus;
+      int queued = __atomic_load_n(&sched->rq[id].nr_queued, __ATOMIC_RELAXED);
+      if (queued > most && !test_bit(id, hot)) {
+        victim = id;
+        most = queued;
+      }
+    }
+    if (victim < 0)
+      return NULL;
 
-void put_proc(struct pcb_t *proc) { return put_mlq_proc(proc); }
+    struct cpu_rq *vrq = &sched->rq[victim];
+    rq_lock(vrq);
+    if (ctx->affinity_window > 0) {
+      struct pcb_t *next = rq_peek(ctx, vrq);
+      if (next != NULL && cache_hot(ctx, victim, next)) {
+        rq_unlock(vrq);
+        set_bit(victim, hot);
+        continue;
+      }
+    }
+    struct pcb_t *proc = rq_pick_quota(ctx, vrq, 1);
+    if (proc != NULL)
+      rq_detach(ctx, vrq, proc);
+    rq_unlock(vrq);
+    if (proc == NULL)
+      continue; /* Its owner was faster, look again */
 
-void add_proc(struct pcb_t *proc) { return add_mlq_proc(proc); }
+    struct cpu_rq *rq = &sched->rq[cpu];
+    rq_lock(rq);
+    rq_attach(ctx, rq, proc);
+    rq_start(ctx, rq, proc);
+    rq->migrations++;
+    rq_unlock(rq);
+    return proc;
+  }
+}
 
-void finish_proc(struct pcb_t **proc) {
-  pthread_mutex_lock(&queue_lock);
-  // increase cpuRemainder
-  mlq_ready_queue[(*proc)->prio].cpuRemainder++;
+struct pcb_t *get_proc(struct sim_ctx *ctx, int cpu) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  rq_lock(rq);
+  __atomic_store_n(&ctx->cpus[cpu].need_resched, 0, __ATOMIC_RELAXED);
+  struct pcb_t *proc = rq_pick_quota(ctx, rq, 0);
+  if (proc != NULL)
+    rq_start(ctx, rq, proc);
+  int left = rq->nr_queued;
+  rq_unlock(rq);
 
-  pthread_mutex_unlock(&queue_lock);
-  free(*proc);
+  if (proc == NULL)
+    proc = steal(ctx, cpu);
+  else if (left > 0)
+    kick(ctx, -1); /* A parked CPU can take the rest */
+  return proc;
+}
+
+uint64_t sched_throttled(struct sim_ctx *ctx, int cpu) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  rq_lock(rq);
+  uint64_t until = rq->grp_unthrottle;
+  rq_unlock(rq);
+  return until;
 }
-#else
-struct pcb_t *get_proc(void) {
-  struct pcb_t *proc = NULL;
-  /*TODO: get a process from [ready_queue].
-   * Remember to use lock to protect the queue.
-   * */
-  if (!empty(&ready_queue)) {
-    proc = dequeue(&ready_queue);
+
+int sched_slice(struct sim_ctx *ctx, int cpu, struct pcb_t *proc) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  rq_lock(rq);
+  int slice = class_of(ctx, proc)->slice(ctx, rq, proc);
+  rq_unlock(rq);
+  /* No more than its group reserved, see group_reserve */
+  if (proc->quota_slots > 0 && (uint32_t)slice > proc->quota_slots)
+    slice = proc->quota_slots;
+  return slice;
+}
+
+void put_proc(struct sim_ctx *ctx, int cpu, struct pcb_t *proc) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  rq_lock(rq);
+  rq_stop(ctx, rq, proc);
+  rq_enqueue(ctx, rq, proc);
+  rq_unlock(rq);
+  /* No wake up, the CPU calls get_proc right after this */
+}
+
+void add_proc(struct sim_ctx *ctx, struct pcb_t *proc) {
+  proc->last_cpu = -1;
+  place_proc(ctx, proc, 0);
+}
+
+void block_proc(struct sim_ctx *ctx, int cpu, struct pcb_t *proc) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  rq_lock(rq);
+  rq_stop(ctx, rq, proc);
+  rq_unlock(rq);
+}
+
+void wake_proc(struct sim_ctx *ctx, struct pcb_t *proc) {
+  /* The CPU holding its EDF share went offline while it waited */
+  if (proc->dl_util && proc->dl_cpu >= 0 &&
+      __atomic_load_n(&ctx->cpus[proc->dl_cpu].state, __ATOMIC_ACQUIRE) !=
+          CPU_ONLINE) {
+    struct cpu_rq *rq = &ctx->sched.rq[proc->dl_cpu];
+    rq_lock(rq);
+    rq_detach(ctx, rq, proc);
+    rq_unlock(rq);
   }
-  return proc;
+  place_proc(ctx, proc, 0);
 }
 
-void put_proc(struct pcb_t *proc) { enqueue(&run_queue, proc); }
+void finish_proc(struct sim_ctx *ctx, int cpu, struct pcb_t **proc) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  rq_lock(rq);
+  rq_stop(ctx, rq, *proc);
+  if ((*proc)->dl_util)
+    rq_detach(ctx, rq, *proc); /* Give its EDF share back */
+  rq_unlock(rq);
+  stats_finish(ctx, *proc);
+  free(*proc);
+  /* It was the last one (or those left wait for each other), the idle
+   * CPUs and the I/O controller can stop */
+  if (sched_finished(ctx))
+    sched_wake_all(ctx);
+}
 
-void add_proc(struct pcb_t *proc) { enqueue(&ready_queue, proc); }
+void sched_drain(struct sim_ctx *ctx, int cpu) {
+  struct cpu_rq *rq = &ctx->sched.rq[cpu];
+  struct queue_t moving;
+  struct pcb_t *proc;
 
-void finish_proc(struct pcb_t **proc) { free(*proc); }
-#endif
+  /* Empty the queues first, place_proc may lock any run queue */
+  init_queue(&moving);
+  rq_lock(rq);
+  /* Their quota is for the CPUs they go to to check */
+  rq_unthrottle(ctx, rq, UINT64_MAX);
+  while ((proc = rq_pick(ctx, rq, 1)) != NULL) {
+    rq_detach(ctx, rq, proc);
+    enqueue(&moving, proc);
+  }
+  rq_unlock(rq);
+
+  while ((proc = dequeue(&moving)) != NULL)
+    place_proc(ctx, proc, 1);
+  free_queue(&moving);
+}
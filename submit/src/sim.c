@@ -0,0 +1,1011 @@
+/*
+ * Simulation engine
+ *  Reads a configure file into a sim_ctx and drives its loader, I/O
+ *  controller and CPUs, either one host thread per device or all from a
+ *  single thread.
+ */
+
+#define _GNU_SOURCE
+
+#include "ckpt.h"
+#include "cpu.h"
+#include "group.h"
+#include "io.h"
+#include "loader.h"
+#include "mm.h"
+#include "sched.h"
+#include "sim.h"
+#include "stats.h"
+#include "thread.h"
+#include "timer.h"
+
+#include "os-cfg.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* What a device did in the current time slot */
+enum slot_status {
+  SLOT_BUSY,  /* Did some work */
+  SLOT_IDLE,  /* Nothing to do, but may have work in the next slot */
+  SLOT_SLEEP, /* Nothing to do before its wake slot */
+  SLOT_AHEAD, /* Did the work of the slots up to its wake slot already */
+  SLOT_WAIT,  /* Same, but work may still come earlier: it stays on the
+               * barrier */
+  SLOT_PARK,  /* Nothing to do until the scheduler wakes it up */
+  SLOT_EXIT   /* Left the simulation */
+};
+
+/* With ctx->pin set, keep host thread [thread] on host core [core] modulo
+ * the number of online cores */
+static void pin_thread(struct sim_ctx *ctx, pthread_t thread, int core) {
+  if (!ctx->pin)
+    return;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core % (cores > 0 ? cores : 1), &set);
+  pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+/* Hand the end of a slot over to the timer, return 0 once the device is
+ * gone. [wake] is read only now, the step that returned [status] may just
+ * have set it */
+static int end_slot(struct timer_id_t *timer_id, enum slot_status status,
+                    const uint64_t *wake) {
+  switch (status) {
+  case SLOT_BUSY:
+    next_slot(timer_id);
+    break;
+  case SLOT_IDLE:
+    idle_slot(timer_id);
+    break;
+  case SLOT_SLEEP:
+    sleep_until(timer_id, *wake);
+    break;
+  case SLOT_AHEAD:
+    busy_until(timer_id, *wake);
+    break;
+  case SLOT_WAIT:
+    idle_until(timer_id, *wake);
+    break;
+  case SLOT_PARK:
+    park_event(timer_id);
+    break;
+  case SLOT_EXIT:
+    detach_event(timer_id);
+    return 0;
+  }
+  return 1;
+}
+
+/* Do the job of a CPU in the current time slot */
+static enum slot_status cpu_step(struct cpu_args *cpu) {
+  struct sim_ctx *ctx = cpu->ctx;
+  int id = cpu->id;
+  struct pcb_t *proc = cpu->proc;
+  uint64_t now = current_time(&ctx->timer);
+
+  /* Still in the slots it ran ahead in slice mode (see below), the
+   * threaded engine sleeps through them */
+  if (now < cpu->run_ahead) {
+    cpu->wake = cpu->run_ahead;
+    return SLOT_SLEEP;
+  }
+
+  /* Slots spent parked or fast-forwarded over */
+  if (cpu->last_slot != UINT64_MAX)
+    cpu->idle_slots += now - cpu->last_slot - 1;
+  cpu->last_slot = now;
+
+  /* Taken offline by a hotplug event, hand the process back */
+  int draining = CPU_DRAINING;
+  if (__atomic_load_n(&cpu->state, __ATOMIC_ACQUIRE) == CPU_DRAINING &&
+      __atomic_compare_exchange_n(&cpu->state, &draining, CPU_OFFLINE, 0,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    if (proc != NULL) {
+      fprintf(ctx->out, "\tCPU %d: Put process %2d to run queue\n", id,
+              proc->pid);
+      put_proc(ctx, id, proc);
+    }
+    sched_drain(ctx, id);
+    __atomic_fetch_sub(&ctx->nr_draining, 1, __ATOMIC_SEQ_CST);
+    /* CPUs parked for this drain may stop now */
+    if (sched_done(ctx))
+      sched_wake_all(ctx);
+    cpu->proc = NULL;
+    cpu->time_left = 0;
+    cpu->stall = 0;
+    cpu->calc_left = 0;
+    fprintf(ctx->out, "\tCPU %d offline\n", id);
+    return SLOT_EXIT;
+  }
+
+  /* In a run of calcs: nothing to look at but a preemption, each slot
+   * retires one of them as run() would */
+  if (cpu->calc_left > 0 &&
+      !__atomic_load_n(&cpu->need_resched, __ATOMIC_ACQUIRE)) {
+    proc->pc++;
+    cpu->calc_left--;
+    cpu->time_left--;
+    cpu->busy_slots++;
+    return SLOT_BUSY;
+  }
+  cpu->calc_left = 0;
+
+  /* Nothing more to come once every process is loaded, no CPU is still
+   * to drain its queues and no process waits on a sync object that can
+   * still be released. Looked at before get_proc, so the processes of a
+   * drain already counted out are seen there */
+  int last = sched_done(ctx);
+
+  /* Check the status of current process */
+  if (proc == NULL) {
+    /* No process is running, the we load new process from
+     * ready queue */
+    proc = get_proc(ctx, id);
+  } else if (proc->pc == proc->end && thread_join(proc) == RUN_BLOCKED) {
+    /* Done, but its threads still use its memory: it waits for them */
+    fprintf(ctx->out, "\tCPU %d: Process %2d waits on its threads\n", id,
+            proc->pid);
+    block_proc(ctx, id, proc);
+    thread_sleep(ctx, proc);
+    proc = get_proc(ctx, id);
+    cpu->time_left = 0;
+    cpu->stall = 0;
+  } else if (proc->pc == proc->end) {
+    /* The porcess has finish it job */
+    fprintf(ctx->out, "\tCPU %d: Processed %2d has finished\n", id,
+            proc->pid);
+    sync_exit(ctx, proc);
+    thread_exit(ctx, proc);
+    finish_proc(ctx, id, &proc);
+    proc = get_proc(ctx, id);
+    cpu->time_left = 0;
+    cpu->stall = 0;
+  } else if (cpu->time_left == 0) {
+    /* The process has done its job in current time slot */
+    fprintf(ctx->out, "\tCPU %d: Put process %2d to run queue\n", id,
+            proc->pid);
+    put_proc(ctx, id, proc);
+    proc = get_proc(ctx, id);
+  } else if (__atomic_load_n(&cpu->need_resched, __ATOMIC_ACQUIRE)) {
+    /* A process that outranks it was queued here, see add_proc */
+    fprintf(ctx->out, "\tCPU %d: Preempted process %2d\n", id, proc->pid);
+    put_proc(ctx, id, proc);
+    proc = get_proc(ctx, id);
+    cpu->time_left = 0;
+    cpu->stall = 0;
+  }
+  cpu->proc = proc;
+
+  /* Recheck process status after loading new process. Processes of a
+   * group parked here out of quota are still to run */
+  uint64_t throttled = proc == NULL ? sched_throttled(ctx, id) : UINT64_MAX;
+  if (proc == NULL && last && throttled == UINT64_MAX) {
+    /* No process to run, exit */
+    fprintf(ctx->out, "\tCPU %d stopped\n", id);
+    __atomic_store_n(&cpu->state, CPU_OFFLINE, __ATOMIC_RELEASE);
+    return SLOT_EXIT;
+  } else if (proc == NULL) {
+    /* There may be new processes to run in
+     * next time slots, wait for them off the slot barrier */
+    cpu->idle_slots++;
+    cpu->wake = throttled;
+    if (throttled != UINT64_MAX)
+      return SLOT_WAIT;
+    return sched_park(ctx, cpu) ? SLOT_PARK : SLOT_IDLE;
+  } else if (cpu->time_left == 0) {
+    fprintf(ctx->out, "\tCPU %d: Dispatched process %2d\n", id, proc->pid);
+    cpu->time_left = sched_slice(ctx, id, proc);
+    /* Cold start on this CPU: last_cpu is still the one it left */
+    if (proc->last_cpu >= 0 && proc->last_cpu != id) {
+      cpu->stall = ctx->migration_penalty;
+      cpu->time_left += cpu->stall;
+    }
+  }
+
+  /* Run current process, once its cache is warm */
+  if (cpu->stall > 0) {
+    cpu->stall--;
+    cpu->stall_slots++;
+  } else if (run(proc) == RUN_BLOCKED) {
+    /* Off the CPU until it gets the object (sync.c), its request is
+     * served (io.c) or its threads are done (thread.c) */
+    const struct code_op *op = &proc->code->ops[proc->pc - 1];
+    block_proc(ctx, id, proc);
+    if (op->opcode == IO) {
+      /* Served from the next slot on at the earliest, so proc is still
+       * ours in this one */
+      const uint32_t *arg = code_args(proc->code, op);
+      uint64_t done = io_submit(ctx, proc, arg[0], arg[1]);
+      fprintf(ctx->out, "\tCPU %d: Process %2d waits on I/O %s until %lu\n",
+              id, proc->pid, ctx->io[arg[0]].name, (unsigned long)done);
+    } else if (op->opcode == JOIN) {
+      fprintf(ctx->out, "\tCPU %d: Process %2d waits on its threads\n", id,
+              proc->pid);
+      thread_sleep(ctx, proc);
+    } else {
+      fprintf(ctx->out, "\tCPU %d: Process %2d waits on %s\n", id, proc->pid,
+              ctx->sync[proc->wait_obj].name);
+      sync_sleep(ctx, proc);
+    }
+    cpu->proc = NULL;
+    cpu->time_left = 0;
+    cpu->stall = 0;
+    cpu->busy_slots++;
+    return SLOT_BUSY;
+  } else {
+    /* The calcs that follow fit in what is left of the slice */
+    int calcs = calc_run(proc);
+    cpu->calc_left = calcs < cpu->time_left - 1 ? calcs : cpu->time_left - 1;
+  }
+  cpu->time_left--;
+  cpu->busy_slots++;
+
+  /* Slice mode: no other device can tell when those calcs run, so they
+   * all run now and the CPU sleeps through their slots. It is back for
+   * the first instruction they could see, or the end of the slice */
+  if (ctx->slice_mode && cpu->calc_left > 0) {
+    int n = cpu->calc_left;
+    proc->pc += n;
+    cpu->time_left -= n;
+    cpu->busy_slots += n;
+    cpu->calc_left = 0;
+    cpu->last_slot = now + n;
+    cpu->run_ahead = now + n + 1;
+    cpu->wake = cpu->run_ahead;
+    return SLOT_AHEAD;
+  }
+  return SLOT_BUSY;
+}
+
+static void *cpu_routine(void *args) {
+  struct cpu_args *cpu = (struct cpu_args *)args;
+  while (end_slot(cpu->timer_id, cpu_step(cpu), &cpu->wake))
+    ;
+  pthread_exit(NULL);
+}
+
+/* Bring CPU [i] (back) online. In the threaded engine this runs on the
+ * loader thread, which has not arrived in the current slot yet, so the
+ * new device can join the barrier right away and step in this slot. */
+static void cpu_online(struct sim_ctx *ctx, int i) {
+  struct cpu_args *cpu = &ctx->cpus[i];
+
+  /* Still draining: just cancel the request */
+  int draining = CPU_DRAINING;
+  if (__atomic_compare_exchange_n(&cpu->state, &draining, CPU_ONLINE, 0,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    __atomic_fetch_sub(&ctx->nr_draining, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (draining == CPU_ONLINE)
+    return;
+
+  /* Offline: the old thread, if any, has left the barrier already */
+  if (cpu->has_thread) {
+    pthread_join(cpu->thread, NULL);
+    cpu->has_thread = 0;
+  }
+  cpu->proc = NULL;
+  cpu->time_left = 0;
+  cpu->stall = 0;
+  cpu->calc_left = 0;
+  cpu->run_ahead = 0;
+  cpu->parked = 0;
+  cpu->last_slot = UINT64_MAX;
+  __atomic_store_n(&cpu->state, CPU_ONLINE, __ATOMIC_RELEASE);
+  if (!ctx->sequential && ctx->workers == 0) {
+    cpu->timer_id = attach_event(&ctx->timer);
+    pthread_create(&cpu->thread, NULL, cpu_routine, (void *)cpu);
+    pin_thread(ctx, cpu->thread, i);
+    cpu->has_thread = 1;
+  }
+}
+
+static void cpu_offline(struct sim_ctx *ctx, int i) {
+  int online = CPU_ONLINE;
+  if (__atomic_compare_exchange_n(&ctx->cpus[i].state, &online, CPU_DRAINING,
+                                  0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    /* Before done is set, see cpu_step */
+    __atomic_fetch_add(&ctx->nr_draining, 1, __ATOMIC_RELAXED);
+    sched_unpark(ctx, &ctx->cpus[i]);
+  }
+}
+
+static void apply_hotplug(struct sim_ctx *ctx, struct hotplug_event *ev) {
+  int i;
+  fprintf(ctx->out, "\tHotplug: %d CPUs online\n", ev->num_cpus);
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (i < ev->num_cpus)
+      cpu_online(ctx, i);
+    else
+      cpu_offline(ctx, i);
+  }
+}
+
+/* Do the job of the loader in the current time slot */
+static enum slot_status ld_step(struct ld_dev *ld) {
+  struct sim_ctx *ctx = ld->ctx;
+  struct ld_args *ld_processes = &ctx->ld_processes;
+  uint64_t now = current_time(&ctx->timer);
+  int hotplugged = 0;
+  while (ld->next_hotplug < ctx->num_hotplug &&
+         ctx->hotplug[ld->next_hotplug].slot <= now) {
+    apply_hotplug(ctx, &ctx->hotplug[ld->next_hotplug++]);
+    hotplugged = 1;
+  }
+
+  int i = ld->next;
+  if (i == ctx->num_processes && ld->next_hotplug == ctx->num_hotplug) {
+    /* Parked CPUs have to see this to stop */
+    __atomic_store_n(&ctx->done, 1, __ATOMIC_RELEASE);
+    sched_wake_all(ctx);
+    return SLOT_EXIT;
+  }
+  if (i == ctx->num_processes || now < ld_processes->start_time[i]) {
+    if (hotplugged)
+      return SLOT_BUSY;
+    ld->wake = UINT64_MAX;
+    if (i < ctx->num_processes)
+      ld->wake = ld_processes->start_time[i];
+    if (ld->next_hotplug < ctx->num_hotplug &&
+        ctx->hotplug[ld->next_hotplug].slot < ld->wake)
+      ld->wake = ctx->hotplug[ld->next_hotplug].slot;
+    return SLOT_SLEEP;
+  }
+
+  struct pcb_t *proc = load(ctx, ld_processes->path[i]);
+#ifdef MLQ_SCHED
+  proc->prio = ld_processes->prio[i];
+#endif
+  proc->group = ld_processes->group[i];
+#ifdef MM_PAGING
+  proc->mm = calloc(1, sizeof(struct mm_struct));
+  init_mm(proc->mm, proc);
+  /* In Paging mode, it needs passing the system mem to each PCB through
+   * loader*/
+  proc->mram = &ctx->mram;
+  proc->mswp = (struct memphy_struct **)&ctx->mswp;
+  proc->active_mswp = &ctx->mswp[0];
+#endif
+#ifdef MLQ_SCHED
+  fprintf(ctx->out, "\tLoaded a process at %s, PID: %d PRIO: %ld\n",
+          ld_processes->path[i], proc->pid, ld_processes->prio[i]);
+#else
+  fprintf(ctx->out, "\tLoaded a process at %s, PID: %d\n",
+          ld_processes->path[i], proc->pid);
+#endif
+  stats_arrive(ctx, proc);
+  if (ld_processes->deadline[i] != 0) {
+    proc->dl_rel = ld_processes->deadline[i];
+    proc->dl_period = ld_processes->period[i];
+    int cpu = sched_admit(ctx, proc);
+    if (cpu >= 0) {
+      fprintf(ctx->out, "\tEDF: process %2d admitted on CPU %d, deadline %lu\n",
+              proc->pid, cpu, (unsigned long)proc->dl_deadline);
+      ctx->dl_admitted++;
+    } else {
+      fprintf(ctx->out, "\tEDF: process %2d rejected\n", proc->pid);
+      ctx->dl_rejected++;
+    }
+  }
+  add_proc(ctx, proc);
+
+  ld->next++;
+  return SLOT_BUSY;
+}
+
+static void *ld_routine(void *args) {
+  struct ld_dev *ld = (struct ld_dev *)args;
+  /* Not again when resuming from a checkpoint */
+  if (current_time(&ld->ctx->timer) == 0)
+    fprintf(ld->ctx->out, "ld_routine\n");
+  while (end_slot(ld->timer_id, ld_step(ld), &ld->wake))
+    ;
+  pthread_exit(NULL);
+}
+
+/* Do the job of the I/O controller in the current time slot */
+static enum slot_status io_step(struct io_ctl *ioc) {
+  struct sim_ctx *ctx = ioc->ctx;
+  /* Busy if it queued processes, the CPUs may have been woken for them */
+  if (io_complete(ctx, &ioc->wake) > 0)
+    return SLOT_BUSY;
+  if (ioc->wake != UINT64_MAX)
+    return SLOT_WAIT;
+  if (sched_park_io(ctx))
+    return SLOT_PARK;
+  if (sched_finished(ctx)) {
+    ioc->exited = 1;
+    return SLOT_EXIT;
+  }
+  /* A request came in meanwhile */
+  return SLOT_IDLE;
+}
+
+static void *io_routine(void *args) {
+  struct io_ctl *ioc = (struct io_ctl *)args;
+  while (end_slot(ioc->timer_id, io_step(ioc), &ioc->wake))
+    ;
+  pthread_exit(NULL);
+}
+
+/* One host thread per CPU plus one for the loader and one for the I/O
+ * controller, all synchronized on the slot barrier of the timer */
+static void run_threaded(struct sim_ctx *ctx) {
+  pthread_t ld, io;
+  int i;
+
+  /* A checkpoint may hold parked CPUs, they get parked again on their own
+   * once they have a place on the barrier */
+  sched_wake_all(ctx);
+
+  /* Init timer, devices that are offline (or stopped before a checkpoint)
+   * stay out */
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (ctx->cpus[i].state != CPU_OFFLINE)
+      ctx->cpus[i].timer_id = attach_event(&ctx->timer);
+  }
+  if (!ctx->done)
+    ctx->ld.timer_id = attach_event(&ctx->timer);
+  if (!ctx->ioc.exited)
+    ctx->ioc.timer_id = attach_event(&ctx->timer);
+  start_timer(&ctx->timer);
+
+  /* Run CPU, loader and I/O controller */
+  if (!ctx->done) {
+    pthread_create(&ld, NULL, ld_routine, (void *)&ctx->ld);
+    pin_thread(ctx, ld, ctx->max_cpus);
+  }
+  if (ctx->ioc.timer_id != NULL) {
+    pthread_create(&io, NULL, io_routine, (void *)&ctx->ioc);
+    pin_thread(ctx, io, ctx->max_cpus + 1);
+  }
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (ctx->cpus[i].state != CPU_OFFLINE) {
+      pthread_create(&ctx->cpus[i].thread, NULL, cpu_routine,
+                     (void *)&ctx->cpus[i]);
+      pin_thread(ctx, ctx->cpus[i].thread, i);
+      ctx->cpus[i].has_thread = 1;
+    }
+  }
+
+  /* Wait for the loader first, it starts the CPUs that come online */
+  if (ctx->ld.timer_id != NULL)
+    pthread_join(ld, NULL);
+  for (i = 0; i < ctx->max_cpus; i++) {
+    if (ctx->cpus[i].has_thread) {
+      pthread_join(ctx->cpus[i].thread, NULL);
+      ctx->cpus[i].has_thread = 0;
+    }
+  }
+  if (ctx->ioc.timer_id != NULL)
+    pthread_join(io, NULL);
+}
+
+/* A host thread of the pooled engine */
+struct pool_worker {
+  struct sim_ctx *ctx;
+  struct timer_id_t *timer_id;
+  int id;
+};
+
+/*
+ * Worker [id] steps the loader if id is 0, then CPUs id, id + workers,
+ * ... in each slot; the devices are resumed by calling their step again,
+ * so a slot boundary costs one barrier round per worker, not per device.
+ * Parked CPUs are skipped until the scheduler clears their flag.
+ */
+static void *worker_routine(void *args) {
+  struct pool_worker *w = (struct pool_worker *)args;
+  struct sim_ctx *ctx = w->ctx;
+  struct ld_dev *ld = &ctx->ld;
+  struct io_ctl *ioc = &ctx->ioc;
+  int i;
+
+  for (;;) {
+    uint64_t now = current_time(&ctx->timer);
+    uint64_t wake = UINT64_MAX;
+    int busy = 0;
+    int cpus_alive = 0;
+
+    if (w->id == 0 && !ctx->done) {
+      if (now >= ld->wake) {
+        enum slot_status status = ld_step(ld);
+        busy |= status == SLOT_BUSY || status == SLOT_EXIT;
+      }
+      if (!ctx->done)
+        wake = ld->wake;
+    }
+    if (w->id == 0 && !ioc->exited &&
+        !__atomic_load_n(&ioc->parked, __ATOMIC_ACQUIRE)) {
+      enum slot_status status = io_step(ioc);
+      busy |= status == SLOT_BUSY || status == SLOT_IDLE;
+      if (status == SLOT_WAIT && ioc->wake < wake)
+        wake = ioc->wake;
+    }
+    for (i = w->id; i < ctx->max_cpus; i += ctx->workers) {
+      struct cpu_args *cpu = &ctx->cpus[i];
+      if (__atomic_load_n(&cpu->state, __ATOMIC_ACQUIRE) == CPU_OFFLINE)
+        continue;
+      cpus_alive++;
+      if (__atomic_load_n(&cpu->parked, __ATOMIC_ACQUIRE))
+        continue;
+      enum slot_status status = cpu_step(cpu);
+      busy |= status == SLOT_BUSY || status == SLOT_AHEAD ||
+              status == SLOT_EXIT;
+      cpus_alive -= status == SLOT_EXIT;
+      if ((status == SLOT_WAIT || status == SLOT_SLEEP ||
+           status == SLOT_AHEAD) &&
+          cpu->wake < wake)
+        wake = cpu->wake;
+    }
+
+    /* No CPU comes back once the loader, which does the hotplug, is done */
+    if (__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE) && !cpus_alive) {
+      detach_event(w->timer_id);
+      break;
+    }
+    if (busy)
+      next_slot(w->timer_id);
+    else
+      idle_until(w->timer_id, wake);
+  }
+  return NULL;
+}
+
+static void run_pooled(struct sim_ctx *ctx) {
+  struct pool_worker *workers = (struct pool_worker *)malloc(
+      ctx->workers * sizeof(struct pool_worker));
+  pthread_t *threads = (pthread_t *)malloc(ctx->workers * sizeof(pthread_t));
+  int i;
+
+  /* Parked CPUs of a checkpoint are stepped again, see run_threaded */
+  sched_wake_all(ctx);
+
+  for (i = 0; i < ctx->workers; i++) {
+    workers[i].ctx = ctx;
+    workers[i].timer_id = attach_event(&ctx->timer);
+    workers[i].id = i;
+  }
+  start_timer(&ctx->timer);
+  if (current_time(&ctx->timer) == 0)
+    fprintf(ctx->out, "ld_routine\n");
+
+  for (i = 0; i < ctx->workers; i++) {
+    pthread_create(&threads[i], NULL, worker_routine, (void *)&workers[i]);
+    pin_thread(ctx, threads[i], i);
+  }
+  for (i = 0; i < ctx->workers; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  free(workers);
+}
+
+/*
+ * Single-threaded engine: one host thread steps the loader and then every
+ * CPU, in this fixed order, on each time slot. The output only depends on
+ * the configuration.
+ */
+static void run_sequential(struct sim_ctx *ctx) {
+  struct ld_dev *ld = &ctx->ld;
+  struct io_ctl *ioc = &ctx->ioc;
+  int i;
+
+  start_timer(&ctx->timer);
+  if (current_time(&ctx->timer) == 0)
+    fprintf(ctx->out, "ld_routine\n");
+  for (;;) {
+    uint64_t now = current_time(&ctx->timer);
+    int busy = 0;
+    int cpus_alive = 0;
+
+    if (ctx->ckpt_path != NULL && now >= ctx->ckpt_slot) {
+      ckpt_save(ctx, ctx->ckpt_path);
+      ctx->ckpt_path = NULL;
+    }
+
+    /* The loader is gone once ctx->done is set */
+    if (!ctx->done && now >= ld->wake) {
+      enum slot_status status = ld_step(ld);
+      busy |= status == SLOT_BUSY || status == SLOT_EXIT;
+    }
+    if (!ioc->exited && !ioc->parked) {
+      enum slot_status status = io_step(ioc);
+      busy |= status == SLOT_BUSY || status == SLOT_IDLE;
+    }
+    uint64_t cpu_wake = UINT64_MAX;
+    for (i = 0; i < ctx->max_cpus; i++) {
+      if (ctx->cpus[i].state == CPU_OFFLINE || ctx->cpus[i].parked) {
+        cpus_alive += ctx->cpus[i].parked;
+        continue;
+      }
+      enum slot_status status = cpu_step(&ctx->cpus[i]);
+      busy |= status == SLOT_BUSY || status == SLOT_AHEAD ||
+              status == SLOT_EXIT;
+      cpus_alive += status != SLOT_EXIT;
+      if ((status == SLOT_WAIT || status == SLOT_SLEEP ||
+           status == SLOT_AHEAD) &&
+          ctx->cpus[i].wake < cpu_wake)
+        cpu_wake = ctx->cpus[i].wake;
+    }
+    if (ctx->done && !cpus_alive)
+      break;
+
+    uint64_t next = now + 1;
+#ifdef TIMER_FASTFWD
+    uint64_t wake = ctx->done ? UINT64_MAX : ld->wake;
+    if (!ioc->exited && !ioc->parked && ioc->wake < wake)
+      wake = ioc->wake;
+    if (cpu_wake < wake)
+      wake = cpu_wake;
+    if ((!busy || !cpus_alive) && wake != UINT64_MAX && wake > next)
+      next = wake;
+#endif
+    step_timer(&ctx->timer, next);
+  }
+}
+
+/*
+ * Optional lines after the process list:
+ *  cpus [slot] [n]   from [slot] on, run with CPUs 0..n-1
+ *  policy [name] ... scheduling policy, see enum sched_policy
+ *  affinity [window] [penalty]   see AFFINITY_WINDOW
+ *  device [name] [latency] [depth]   see io.h, IO_LATENCY otherwise
+ *  group [name] [shares] [quota] [period]   see group.h, the quota and
+ *                                           period optional
+ */
+static int read_directives(struct sim_ctx *ctx, FILE *file) {
+  char line[100];
+  ctx->max_cpus = ctx->num_cpus;
+  ctx->cfs_latency = CFS_TARGET_LATENCY;
+  ctx->cfs_min_gran = CFS_MIN_GRANULARITY;
+  ctx->affinity_window = AFFINITY_WINDOW;
+  ctx->migration_penalty = MIGRATION_PENALTY;
+  ctx->preempt = SCHED_PREEMPT;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char key[16];
+    if (sscanf(line, "%15s", key) != 1)
+      continue;
+    if (strcmp(key, "cpus") == 0) {
+      struct hotplug_event ev;
+      if (sscanf(line, "%*s %lu %d", &ev.slot, &ev.num_cpus) != 2 ||
+          ev.num_cpus < 0) {
+        fprintf(ctx->out, "Bad hotplug line: %s", line);
+        return -1;
+      }
+      /* Keep the events sorted on their slot, in file order on a tie */
+      ctx->hotplug = realloc(ctx->hotplug, (ctx->num_hotplug + 1) *
+                                               sizeof(struct hotplug_event));
+      int i = ctx->num_hotplug++;
+      while (i > 0 && ctx->hotplug[i - 1].slot > ev.slot) {
+        ctx->hotplug[i] = ctx->hotplug[i - 1];
+        i--;
+      }
+      ctx->hotplug[i] = ev;
+      if (ev.num_cpus > ctx->max_cpus)
+        ctx->max_cpus = ev.num_cpus;
+    } else if (strcmp(key, "policy") == 0) {
+      /* policy mlq | fifo | stride | lottery
+       * policy cfs [target latency] [min granularity] */
+      char name[16];
+      int latency = CFS_TARGET_LATENCY, min_gran = CFS_MIN_GRANULARITY;
+      int n = sscanf(line, "%*s %15s %d %d", name, &latency, &min_gran);
+      int policy = n >= 1 ? sched_policy_by_name(name) : -1;
+      if (policy == POLICY_CFS && latency >= 1 && min_gran >= 1) {
+        ctx->cfs_latency = latency;
+        ctx->cfs_min_gran = min_gran;
+      } else if (policy < 0 || policy == POLICY_CFS || n != 1) {
+        fprintf(ctx->out, "Bad policy line: %s", line);
+        return -1;
+      }
+      ctx->policy = policy;
+    } else if (strcmp(key, "affinity") == 0) {
+      int window, penalty = MIGRATION_PENALTY;
+      int n = sscanf(line, "%*s %d %d", &window, &penalty);
+      if (n < 1 || window < 0 || penalty < 0) {
+        fprintf(ctx->out, "Bad affinity line: %s", line);
+        return -1;
+      }
+      ctx->affinity_window = window;
+      ctx->migration_penalty = penalty;
+    } else if (strcmp(key, "preempt") == 0) {
+      char mode[8];
+      if (sscanf(line, "%*s %7s", mode) != 1 ||
+          (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)) {
+        fprintf(ctx->out, "Bad preempt line: %s", line);
+        return -1;
+      }
+      ctx->preempt = strcmp(mode, "on") == 0;
+    } else if (strcmp(key, "sem") == 0) {
+      /* sem [name] [count]: units the semaphore starts with */
+      char name[SYNC_NAME_LEN];
+      int count, n = ctx->nr_sync;
+      if (sscanf(line, "%*s %15s %d", name, &count) != 2 || count < 0 ||
+          sync_lookup(ctx, name, SYNC_SEM, count) != n) {
+        fprintf(ctx->out, "Bad sem line: %s", line);
+        return -1;
+      }
+    } else if (strcmp(key, "device") == 0) {
+      char name[IO_NAME_LEN];
+      int latency, depth, n = ctx->nr_io_devs;
+      if (sscanf(line, "%*s %15s %d %d", name, &latency, &depth) != 3 ||
+          latency < 0 || depth < 1 || depth > IO_MAX_DEPTH ||
+          io_lookup(ctx, name, latency, depth) != n) {
+        fprintf(ctx->out, "Bad device line: %s", line);
+        return -1;
+      }
+    } else if (strcmp(key, "group") == 0) {
+      char name[GROUP_NAME_LEN];
+      int shares, quota = 0, period = 0;
+      int n = sscanf(line, "%*s %15s %d %d %d", name, &shares, &quota, &period);
+      int g = n >= 2 ? group_lookup(ctx, name) : -1;
+      if (g < 0 || shares < 1 || (n != 2 && n != 4) || quota < 0 ||
+          (quota > 0 && period < 1)) {
+        fprintf(ctx->out, "Bad group line: %s", line);
+        return -1;
+      }
+      ctx->groups[g].shares = shares;
+      ctx->groups[g].quota = quota;
+      ctx->groups[g].period = period;
+    } else {
+      fprintf(ctx->out, "Unknown configure line: %s", line);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int read_config(struct sim_ctx *ctx, const char *path) {
+  struct ld_args *ld_processes = &ctx->ld_processes;
+  FILE *file;
+  if ((file = fopen(path, "r")) == NULL) {
+    fprintf(ctx->out, "Cannot find configure file at %s\n", path);
+    return -1;
+  }
+  fscanf(file, "%d %d %d\n", &ctx->time_slot, &ctx->num_cpus,
+         &ctx->num_processes);
+  /* Zeroed, free_config frees the paths read so far if a line is bad */
+  ld_processes->path = (char **)calloc(ctx->num_processes, sizeof(char *));
+  ld_processes->start_time =
+      (unsigned long *)malloc(sizeof(unsigned long) * ctx->num_processes);
+#ifdef MM_PAGING
+  int sit;
+#ifdef MM_FIXED_MEMSZ
+  /* We provide here a back compatible with legacy OS simulatiom config file
+   * In which, it have no addition config line for Mema, keep only one line
+   * for legacy info
+   *  [time slice] [N = Number of CPU] [M = Number of Processes to be run]
+   */
+  ctx->memramsz = 0x100000;
+  ctx->memswpsz[0] = 0x1000000;
+  for (sit = 1; sit < PAGING_MAX_MMSWP; sit++)
+    ctx->memswpsz[sit] = 0;
+#else
+  /* Read input config of memory size: MEMRAM and upto 4 MEMSWP (mem swap)
+   * Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
+   *        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
+   */
+  fscanf(file, "%d\n", &ctx->memramsz);
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+    fscanf(file, "%d", &(ctx->memswpsz[sit]));
+  }
+  fscanf(file, "\n"); /* Final character */
+#endif
+#endif
+
+#ifdef MLQ_SCHED
+  ld_processes->prio =
+      (unsigned long *)malloc(sizeof(unsigned long) * ctx->num_processes);
+#endif
+  ld_processes->deadline =
+      (unsigned long *)calloc(ctx->num_processes, sizeof(unsigned long));
+  ld_processes->period =
+      (unsigned long *)calloc(ctx->num_processes, sizeof(unsigned long));
+  ld_processes->group = (int *)calloc(ctx->num_processes, sizeof(int));
+  group_lookup(ctx, GROUP_DEFAULT);
+  int i;
+  for (i = 0; i < ctx->num_processes; i++) {
+    ld_processes->path[i] = (char *)malloc(sizeof(char) * 100);
+    ld_processes->path[i][0] = '\0';
+    strcat(ld_processes->path[i], "input/proc/");
+    char proc[100];
+#ifdef MLQ_SCHED
+    char line[100];
+    fgets(line, 100, file);
+    /* [start] [path] [prio] [deadline] [period] @[group], the last three
+     * optional. A period only sizes the admission of the deadline, the
+     * process still runs once (see sched_admit) */
+    char *tag = strchr(line, '@');
+    if (tag != NULL) {
+      char name[GROUP_NAME_LEN];
+      *tag = '\0';
+      if (sscanf(tag + 1, "%15s", name) != 1 ||
+          (ld_processes->group[i] = group_lookup(ctx, name)) < 0) {
+        fprintf(ctx->out, "Bad group of process %d: @%s", i, tag + 1);
+        fclose(file);
+        return -1;
+      }
+    }
+    sscanf(line, "%lu %s %lu %lu %lu", &ld_processes->start_time[i], proc,
+           &ld_processes->prio[i], &ld_processes->deadline[i],
+           &ld_processes->period[i]);
+#else
+    fscanf(file, "%lu %s\n", &ld_processes->start_time[i], proc);
+#endif
+    strcat(ld_processes->path[i], proc);
+  }
+  int ret = read_directives(ctx, file);
+  fclose(file);
+  return ret;
+}
+
+/* Free what read_config allocated, all of it or the part it read before
+ * an error */
+static void free_config(struct sim_ctx *ctx) {
+  int i;
+  if (ctx->ld_processes.path != NULL) {
+    for (i = 0; i < ctx->num_processes; i++)
+      free(ctx->ld_processes.path[i]);
+  }
+  free(ctx->ld_processes.path);
+  free(ctx->ld_processes.start_time);
+#ifdef MLQ_SCHED
+  free(ctx->ld_processes.prio);
+#endif
+  free(ctx->ld_processes.deadline);
+  free(ctx->ld_processes.period);
+  free(ctx->ld_processes.group);
+  free(ctx->hotplug);
+  sync_destroy(ctx);
+  io_destroy(ctx);
+  group_destroy(ctx);
+}
+
+int sim_init(struct sim_ctx *ctx, const char *path, FILE *out) {
+  memset(ctx, 0, sizeof(struct sim_ctx));
+  ctx->out = out;
+  if (read_config(ctx, path) < 0) {
+    free_config(ctx);
+    return -1;
+  }
+
+  ctx->avail_pid = 1;
+  pthread_mutex_init(&ctx->vm_lock, NULL);
+  init_timer(&ctx->timer, out);
+
+  /* sizeof(struct cpu_args) is a whole number of cache lines */
+  ctx->cpus = (struct cpu_args *)aligned_alloc(
+      CACHE_LINE_SIZE, sizeof(struct cpu_args) * ctx->max_cpus);
+  int i;
+  for (i = 0; i < ctx->max_cpus; i++) {
+    ctx->cpus[i].ctx = ctx;
+    ctx->cpus[i].timer_id = NULL;
+    ctx->cpus[i].id = i;
+    ctx->cpus[i].proc = NULL;
+    ctx->cpus[i].time_left = 0;
+    ctx->cpus[i].stall = 0;
+    ctx->cpus[i].calc_left = 0;
+    ctx->cpus[i].run_ahead = 0;
+    ctx->cpus[i].state = i < ctx->num_cpus ? CPU_ONLINE : CPU_OFFLINE;
+    ctx->cpus[i].has_thread = 0;
+    ctx->cpus[i].parked = 0;
+    ctx->cpus[i].need_resched = 0;
+    ctx->cpus[i].wake = UINT64_MAX;
+    ctx->cpus[i].last_slot = UINT64_MAX;
+    ctx->cpus[i].idle_slots = 0;
+    ctx->cpus[i].busy_slots = 0;
+    ctx->cpus[i].stall_slots = 0;
+  }
+  /* Grown by stats_finish if threads are spawned */
+  ctx->finished_cap = ctx->num_processes ? ctx->num_processes : 1;
+  ctx->finished = (struct proc_stats *)calloc(ctx->finished_cap,
+                                              sizeof(struct proc_stats));
+  ctx->nr_finished = 0;
+  pthread_mutex_init(&ctx->stats_lock, NULL);
+  ctx->nr_threads = 0;
+  ctx->joiners = NULL;
+  pthread_mutex_init(&ctx->thread_lock, NULL);
+  ctx->ld.ctx = ctx;
+  ctx->ld.timer_id = NULL;
+  ctx->ld.next = 0;
+  ctx->ld.next_hotplug = 0;
+  ctx->ld.wake = 0;
+  ctx->ioc.ctx = ctx;
+  ctx->ioc.timer_id = NULL;
+  ctx->ioc.parked = 0;
+  ctx->ioc.exited = 0;
+  ctx->ioc.wake = UINT64_MAX;
+  pthread_mutex_init(&ctx->io_lock, NULL);
+
+#ifdef MM_PAGING
+  /* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
+  int rdmflag = 1; /* By default memphy is RANDOM ACCESS MEMORY */
+
+  /* Create MEM RAM */
+  init_memphy(&ctx->mram, ctx->memramsz, rdmflag);
+
+  /* Create all MEM SWAP */
+  int sit;
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+    init_memphy(&ctx->mswp[sit], ctx->memswpsz[sit], rdmflag);
+#endif
+
+  /* Init scheduler */
+  init_scheduler(ctx);
+  return 0;
+}
+
+void sim_run(struct sim_ctx *ctx) {
+  if (ctx->sequential)
+    run_sequential(ctx);
+  else if (ctx->workers > 0)
+    run_pooled(ctx);
+  else
+    run_threaded(ctx);
+
+  int i;
+  for (i = 0; i < ctx->max_cpus; i++)
+    fprintf(ctx->out, "CPU %d: %lu idle slots\n", i,
+            (unsigned long)ctx->cpus[i].idle_slots);
+  for (i = 0; i < ctx->max_cpus; i++)
+    fprintf(ctx->out, "CPU %d: %lu migrations, %lu contended locks\n", i,
+            (unsigned long)ctx->sched.rq[i].migrations,
+            (unsigned long)ctx->sched.rq[i].contended);
+  if (ctx->dl_admitted + ctx->dl_rejected > 0)
+    fprintf(ctx->out, "EDF: %d admitted, %d rejected, %d deadlines missed\n",
+            ctx->dl_admitted, ctx->dl_rejected, ctx->dl_missed);
+  for (i = 0; i < ctx->nr_sync; i++)
+    fprintf(ctx->out, "Sync %s: %lu acquired, %lu after waiting\n",
+            ctx->sync[i].name, (unsigned long)ctx->sync[i].acquired,
+            (unsigned long)ctx->sync[i].blocked);
+  if (ctx->nr_blocked > 0)
+    fprintf(ctx->out, "Sync: %d processes deadlocked\n", ctx->nr_blocked);
+  /* The default group alone is not worth a line */
+  for (i = 0; i < ctx->nr_groups; i++) {
+    struct sched_group *grp = &ctx->groups[i];
+    if (ctx->nr_groups > 1 || grp->quota > 0)
+      fprintf(ctx->out, "Group %s: %lu slots run, throttled %lu times\n",
+              grp->name, (unsigned long)grp->run,
+              (unsigned long)grp->throttled);
+  }
+  uint64_t slots = current_time(&ctx->timer);
+  for (i = 0; i < ctx->nr_io_devs; i++) {
+    struct io_device *dev = &ctx->io[i];
+    fprintf(ctx->out,
+            "I/O %s: %lu requests, %.2f slots waiting on average, %.2f%% "
+            "busy\n",
+            dev->name, (unsigned long)dev->requests,
+            dev->requests ? (double)dev->wait_slots / dev->requests : 0.0,
+            slots ? 100.0 * dev->service_slots / (dev->depth * slots) : 0.0);
+  }
+
+  /* Stop timer */
+  stop_timer(&ctx->timer);
+}
+
+void sim_destroy(struct sim_ctx *ctx) {
+  free(ctx->cpus);
+  free(ctx->finished);
+#ifdef MM_PAGING
+  if (!ckpt_mapped(ctx, ctx->mram.storage))
+    free(ctx->mram.storage);
+  int sit;
+  for (sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+    if (!ckpt_mapped(ctx, ctx->mswp[sit].storage))
+      free(ctx->mswp[sit].storage);
+  }
+#endif
+  finish_scheduler(ctx);
+  thread_destroy(ctx);
+  free_config(ctx);
+  pthread_mutex_destroy(&ctx->io_lock);
+  pthread_mutex_destroy(&ctx->thread_lock);
+  pthread_mutex_destroy(&ctx->stats_lock);
+  pthread_mutex_destroy(&ctx->vm_lock);
+  ckpt_unmap(ctx);
+}
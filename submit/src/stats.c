@@ -0,0 +1,257 @@
+
+#include "stats.h"
+#include "sim.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void stats_arrive(struct sim_ctx *ctx, struct pcb_t *proc) {
+  struct proc_stats *st = &proc->stats;
+  memset(st, 0, sizeof(*st));
+  st->pid = proc->pid;
+#ifdef MLQ_SCHED
+  st->prio = proc->prio;
+#endif
+  st->arrival = current_time(&ctx->timer);
+  st->first_run = UINT64_MAX;
+}
+
+void stats_finish(struct sim_ctx *ctx, struct pcb_t *proc) {
+  proc->stats.finish = current_time(&ctx->timer);
+  if (proc->stats.deadline && proc->stats.finish > proc->stats.deadline)
+    __atomic_fetch_add(&ctx->dl_missed, 1, __ATOMIC_RELAXED);
+  /* Threads are not in the configure file, they may need more room */
+  pthread_mutex_lock(&ctx->stats_lock);
+  if (ctx->nr_finished == ctx->finished_cap) {
+    int cap = ctx->finished_cap ? 2 * ctx->finished_cap : 16;
+    struct proc_stats *finished = (struct proc_stats *)realloc(
+        ctx->finished, cap * sizeof(struct proc_stats));
+    if (finished == NULL) {
+      fprintf(stderr, "Out of memory growing the finished processes to %d\n",
+              cap);
+      abort();
+    }
+    ctx->finished = finished;
+    ctx->finished_cap = cap;
+  }
+  ctx->finished[ctx->nr_finished] = proc->stats;
+  /* Once the record is in, the count is also read by sched_done */
+  __atomic_fetch_add(&ctx->nr_finished, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&ctx->stats_lock);
+}
+
+/* Distribution of one metric */
+struct summary {
+  int count;
+  double mean, min, p50, p90, p99, max;
+};
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Nearest rank: the smallest value with [p] percent of them at or below */
+static double percentile(const double *sorted, int n, int p) {
+  int rank = (p * n + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/* Sorts [v] */
+static struct summary summarize(double *v, int n) {
+  struct summary s;
+  memset(&s, 0, sizeof(s));
+  s.count = n;
+  if (n == 0)
+    return s;
+  qsort(v, n, sizeof(double), cmp_double);
+  int i;
+  for (i = 0; i < n; i++)
+    s.mean += v[i];
+  s.mean /= n;
+  s.min = v[0];
+  s.p50 = percentile(v, n, 50);
+  s.p90 = percentile(v, n, 90);
+  s.p99 = percentile(v, n, 99);
+  s.max = v[n - 1];
+  return s;
+}
+
+enum metric {
+  M_TURNAROUND,
+  M_RESPONSE,
+  M_WAITING,
+  M_BLOCKED,
+  M_RUN,
+  M_SWITCHES,
+  M_MIGRATION_RATE,
+  M_LATENESS,
+  M_UTILIZATION,
+  NUM_METRICS
+};
+
+static const char *metric_names[NUM_METRICS] = {
+    "turnaround", "response",       "waiting",  "blocked",    "run",
+    "switches",   "migration_rate", "lateness", "utilization"};
+
+static double proc_metric(const struct proc_stats *st, int m) {
+  switch (m) {
+  case M_TURNAROUND:
+    return st->finish - st->arrival;
+  case M_RESPONSE:
+    return st->first_run - st->arrival;
+  case M_WAITING:
+    return st->wait;
+  case M_BLOCKED:
+    return st->blocked;
+  case M_RUN:
+    return st->run;
+  case M_SWITCHES:
+    return st->switches;
+  default:
+    /* Percent of its dispatches */
+    return st->switches ? 100.0 * st->migrations / st->switches : 0;
+  }
+}
+
+/* Percent of its online slots CPU [cpu] ran instructions, not counting
+ * the migration stalls */
+static double utilization(struct cpu_args *cpu) {
+  uint64_t total = cpu->busy_slots + cpu->idle_slots;
+  return total ? 100.0 * (cpu->busy_slots - cpu->stall_slots) / total : 0;
+}
+
+static int cmp_pid(const void *a, const void *b) {
+  const struct proc_stats *x = a, *y = b;
+  return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+static void write_summary_json(FILE *f, const char *name,
+                               struct summary *s, int last) {
+  fprintf(f,
+          "    \"%s\": {\"count\": %d, \"mean\": %.2f, \"min\": %.2f, "
+          "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}%s\n",
+          name, s->count, s->mean, s->min, s->p50, s->p90, s->p99, s->max,
+          last ? "" : ",");
+}
+
+int stats_write(struct sim_ctx *ctx, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open metrics file %s\n", path);
+    return -1;
+  }
+
+  int n = ctx->nr_finished;
+  struct proc_stats *procs = ctx->finished;
+  qsort(procs, n, sizeof(*procs), cmp_pid);
+  uint64_t dispatches = 0, migrations = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    dispatches += procs[i].switches;
+    migrations += procs[i].migrations;
+  }
+
+  struct summary sum[NUM_METRICS];
+  int size = n > ctx->max_cpus ? n : ctx->max_cpus;
+  double *v = (double *)malloc((size ? size : 1) * sizeof(double));
+  int m;
+  for (m = 0; m < M_LATENESS; m++) {
+    for (i = 0; i < n; i++)
+      v[i] = proc_metric(&procs[i], m);
+    sum[m] = summarize(v, n);
+  }
+  /* Of the processes with a deadline only, negative if they made it */
+  int nr_dl = 0;
+  for (i = 0; i < n; i++) {
+    if (procs[i].deadline)
+      v[nr_dl++] = (double)procs[i].finish - (double)procs[i].deadline;
+  }
+  sum[M_LATENESS] = summarize(v, nr_dl);
+  for (i = 0; i < ctx->max_cpus; i++)
+    v[i] = utilization(&ctx->cpus[i]);
+  sum[M_UTILIZATION] = summarize(v, ctx->max_cpus);
+  free(v);
+
+  uint64_t slots = current_time(&ctx->timer);
+  size_t len = strlen(path);
+  if (len >= 5 && strcmp(path + len - 5, ".json") == 0) {
+    fprintf(f,
+            "{\n  \"slots\": %lu,\n  \"throughput\": %.4f,\n"
+            "  \"dispatches\": %lu,\n"
+            "  \"migrations\": %lu,\n  \"migration_rate\": %.2f,\n"
+            "  \"edf\": {\"admitted\": %d, \"rejected\": %d, "
+            "\"missed\": %d},\n"
+            "  \"processes\": [\n",
+            (unsigned long)slots, slots ? (double)n / slots : 0.0,
+            (unsigned long)dispatches, (unsigned long)migrations,
+            dispatches ? 100.0 * migrations / dispatches : 0.0,
+            ctx->dl_admitted, ctx->dl_rejected, ctx->dl_missed);
+    for (i = 0; i < n; i++) {
+      struct proc_stats *st = &procs[i];
+      fprintf(f,
+              "    {\"pid\": %u, \"prio\": %u, \"arrival\": %lu, "
+              "\"first_run\": %lu, \"finish\": %lu, \"turnaround\": %lu, "
+              "\"response\": %lu, \"waiting\": %lu, \"blocked\": %lu, "
+              "\"run\": %lu, "
+              "\"switches\": %lu, \"migrations\": %lu, "
+              "\"deadline\": %lu}%s\n",
+              st->pid, st->prio, (unsigned long)st->arrival,
+              (unsigned long)st->first_run, (unsigned long)st->finish,
+              (unsigned long)(st->finish - st->arrival),
+              (unsigned long)(st->first_run - st->arrival),
+              (unsigned long)st->wait, (unsigned long)st->blocked,
+              (unsigned long)st->run,
+              (unsigned long)st->switches, (unsigned long)st->migrations,
+              (unsigned long)st->deadline, i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"cpus\": [\n");
+    for (i = 0; i < ctx->max_cpus; i++) {
+      struct cpu_args *cpu = &ctx->cpus[i];
+      fprintf(f,
+              "    {\"cpu\": %d, \"busy\": %lu, \"stalled\": %lu, "
+              "\"idle\": %lu, \"utilization\": %.2f}%s\n",
+              i, (unsigned long)cpu->busy_slots,
+              (unsigned long)cpu->stall_slots, (unsigned long)cpu->idle_slots,
+              utilization(cpu),
+              i + 1 < ctx->max_cpus ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"devices\": [\n");
+    for (i = 0; i < ctx->nr_io_devs; i++) {
+      struct io_device *dev = &ctx->io[i];
+      fprintf(f,
+              "    {\"name\": \"%s\", \"latency\": %d, \"depth\": %d, "
+              "\"requests\": %lu, \"wait\": %.2f, \"service\": %.2f, "
+              "\"utilization\": %.2f}%s\n",
+              dev->name, dev->latency, dev->depth,
+              (unsigned long)dev->requests,
+              dev->requests ? (double)dev->wait_slots / dev->requests : 0.0,
+              dev->requests ? (double)dev->service_slots / dev->requests : 0.0,
+              slots ? 100.0 * dev->service_slots / (dev->depth * slots) : 0.0,
+              i + 1 < ctx->nr_io_devs ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"groups\": [\n");
+    for (i = 0; i < ctx->nr_groups; i++) {
+      struct sched_group *grp = &ctx->groups[i];
+      fprintf(f,
+              "    {\"name\": \"%s\", \"shares\": %u, \"quota\": %u, "
+              "\"period\": %u, \"run\": %lu, \"throttled\": %lu}%s\n",
+              grp->name, grp->shares, grp->quota, grp->period,
+              (unsigned long)grp->run, (unsigned long)grp->throttled,
+              i + 1 < ctx->nr_groups ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"summary\": {\n");
+    for (m = 0; m < NUM_METRICS; m++)
+      write_summary_json(f, metric_names[m], &sum[m], m == NUM_METRICS - 1);
+    fprintf(f, "  }\n}\n");
+  } else {
+    fprintf(f, "metric,count,mean,min,p50,p90,p99,max\n");
+    for (m = 0; m < NUM_METRICS; m++)
+      fprintf(f, "%s,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", metric_names[m],
+              sum[m].count, sum[m].mean, sum[m].min, sum[m].p50, sum[m].p90,
+              sum[m].p99, sum[m].max);
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
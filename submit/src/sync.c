@@ -0,0 +1,152 @@
+
+#include "sync.h"
+#include "cpu.h"
+#include "sched.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int sync_lookup(struct sim_ctx *ctx, const char *name, int kind, int count) {
+  int i;
+  for (i = 0; i < ctx->nr_sync; i++) {
+    if (strcmp(ctx->sync[i].name, name) == 0)
+      return ctx->sync[i].kind == kind ? i : -1;
+  }
+  if (ctx->nr_sync == SYNC_MAX_OBJS || strlen(name) >= SYNC_NAME_LEN)
+    return -1;
+
+  /* Only the loader adds objects, before any process can use them */
+  struct sync_obj *obj = &ctx->sync[ctx->nr_sync];
+  pthread_mutex_init(&obj->lock, NULL);
+  strcpy(obj->name, name);
+  obj->kind = kind;
+  obj->count = count;
+  obj->owner = 0;
+  init_queue(&obj->waiters);
+  obj->acquired = 0;
+  obj->blocked = 0;
+  return ctx->nr_sync++;
+}
+
+/* The oldest waiter of [obj] gets it, obj lock held. Return it, to be
+ * queued once the lock is dropped, or NULL if nobody waits and the unit
+ * is left free */
+static struct pcb_t *release(struct sim_ctx *ctx, struct sync_obj *obj) {
+  struct pcb_t *next = dequeue(&obj->waiters);
+  if (next == NULL) {
+    obj->count++;
+    obj->owner = 0;
+    return NULL;
+  }
+  if (obj->kind == SYNC_MUTEX)
+    obj->owner = next->pid;
+  obj->acquired++;
+  obj->blocked++;
+  __atomic_fetch_sub(&ctx->nr_blocked, 1, __ATOMIC_SEQ_CST);
+  return next;
+}
+
+/* [proc] waited on [obj] and has it now */
+static void wake(struct sim_ctx *ctx, struct sync_obj *obj,
+                 struct pcb_t *proc) {
+  proc->stats.blocked += current_time(&ctx->timer) - proc->stats.blocked_since;
+  fprintf(ctx->out, "\tProcess %2d woken up, holds %s\n", proc->pid,
+          obj->name);
+  wake_proc(ctx, proc);
+}
+
+int sync_run(struct pcb_t *proc, uint32_t opcode, uint32_t id) {
+  struct sim_ctx *ctx = proc->ctx;
+  struct sync_obj *obj = &ctx->sync[id];
+  struct pcb_t *next = NULL;
+  int stat = 0;
+
+  pthread_mutex_lock(&obj->lock);
+  switch (opcode) {
+  case LOCK:
+  case WAIT:
+    if (obj->kind == SYNC_MUTEX && obj->owner == proc->pid) {
+      stat = 1; /* It would wait for itself */
+    } else if (obj->count > 0) {
+      obj->count--;
+      if (obj->kind == SYNC_MUTEX)
+        obj->owner = proc->pid;
+      obj->acquired++;
+    } else {
+      proc->wait_obj = id;
+      stat = RUN_BLOCKED;
+    }
+    break;
+  case UNLOCK:
+    if (obj->owner != proc->pid) {
+      stat = 1;
+      break;
+    }
+    next = release(ctx, obj);
+    break;
+  case SIGNAL:
+    next = release(ctx, obj);
+    break;
+  default:
+    stat = 1;
+  }
+  pthread_mutex_unlock(&obj->lock);
+
+  if (next != NULL)
+    wake(ctx, obj, next);
+  return stat;
+}
+
+void sync_sleep(struct sim_ctx *ctx, struct pcb_t *proc) {
+  struct sync_obj *obj = &ctx->sync[proc->wait_obj];
+  proc->stats.blocked_since = current_time(&ctx->timer);
+
+  pthread_mutex_lock(&obj->lock);
+  /* Released since sync_run looked */
+  if (obj->count > 0) {
+    obj->count--;
+    if (obj->kind == SYNC_MUTEX)
+      obj->owner = proc->pid;
+    obj->acquired++;
+    pthread_mutex_unlock(&obj->lock);
+    wake_proc(ctx, proc);
+    return;
+  }
+  enqueue(&obj->waiters, proc);
+  __atomic_fetch_add(&ctx->nr_blocked, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&obj->lock);
+
+  /* The idle CPUs stop if this was the last process that could run */
+  if (sched_done(ctx))
+    sched_wake_all(ctx);
+}
+
+void sync_exit(struct sim_ctx *ctx, struct pcb_t *proc) {
+  int i;
+  for (i = 0; i < ctx->nr_sync; i++) {
+    struct sync_obj *obj = &ctx->sync[i];
+    if (obj->kind != SYNC_MUTEX ||
+        __atomic_load_n(&obj->owner, __ATOMIC_RELAXED) != proc->pid)
+      continue;
+    pthread_mutex_lock(&obj->lock);
+    struct pcb_t *next = release(ctx, obj);
+    pthread_mutex_unlock(&obj->lock);
+    if (next != NULL)
+      wake(ctx, obj, next);
+  }
+}
+
+void sync_destroy(struct sim_ctx *ctx) {
+  int i;
+  for (i = 0; i < ctx->nr_sync; i++) {
+    struct sync_obj *obj = &ctx->sync[i];
+    struct pcb_t *proc;
+    while ((proc = dequeue(&obj->waiters)) != NULL)
+      free(proc);
+    free_queue(&obj->waiters);
+    pthread_mutex_destroy(&obj->lock);
+  }
+  ctx->nr_sync = 0;
+}
@@ -0,0 +1,124 @@
+
+#include "thread.h"
+#include "cpu.h"
+#include "sched.h"
+#include "sim.h"
+#include "stats.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int thread_spawn(struct pcb_t *proc, uint32_t n) {
+  struct sim_ctx *ctx = proc->ctx;
+  if (n == 0 || n > proc->end - proc->pc)
+    return 1;
+
+  /* Same address space and code, its own context */
+  struct pcb_t *thread = (struct pcb_t *)calloc(1, sizeof(struct pcb_t));
+  thread->ctx = ctx;
+  thread->pid = __atomic_fetch_add(&ctx->avail_pid, 1, __ATOMIC_RELAXED);
+  thread->tgid = proc->tgid;
+  thread->parent = proc;
+  thread->priority = proc->priority;
+  thread->group = proc->group;
+  thread->code = proc->code;
+  memcpy(thread->regs, proc->regs, sizeof(proc->regs));
+  thread->pc = proc->pc;
+  thread->end = proc->pc + n;
+#ifdef MLQ_SCHED
+  thread->prio = proc->prio;
+#endif
+#ifdef MM_PAGING
+  thread->mm = proc->mm;
+  thread->mram = proc->mram;
+  thread->mswp = proc->mswp;
+  thread->active_mswp = proc->active_mswp;
+#endif
+  thread->page_table = proc->page_table;
+  thread->bp = proc->bp;
+  thread->dl_cpu = -1;
+  proc->pc += n;
+
+  pthread_mutex_lock(&ctx->thread_lock);
+  proc->nr_threads++;
+  pthread_mutex_unlock(&ctx->thread_lock);
+  /* Counted before it can be queued, see sched_finished */
+  __atomic_fetch_add(&ctx->nr_threads, 1, __ATOMIC_SEQ_CST);
+
+  fprintf(ctx->out, "\tProcess %2d: spawned thread %2d\n", proc->pid,
+          thread->pid);
+  stats_arrive(ctx, thread);
+  add_proc(ctx, thread);
+  return 0;
+}
+
+int thread_join(struct pcb_t *proc) {
+  struct sim_ctx *ctx = proc->ctx;
+  pthread_mutex_lock(&ctx->thread_lock);
+  int running = proc->nr_threads;
+  pthread_mutex_unlock(&ctx->thread_lock);
+  return running > 0 ? RUN_BLOCKED : 0;
+}
+
+void thread_sleep(struct sim_ctx *ctx, struct pcb_t *proc) {
+  proc->stats.blocked_since = current_time(&ctx->timer);
+
+  pthread_mutex_lock(&ctx->thread_lock);
+  /* Its threads finished since thread_join looked */
+  if (proc->nr_threads == 0) {
+    pthread_mutex_unlock(&ctx->thread_lock);
+    wake_proc(ctx, proc);
+    return;
+  }
+  proc->joining = 1;
+  proc->join_prev = NULL;
+  proc->join_next = ctx->joiners;
+  if (ctx->joiners != NULL)
+    ctx->joiners->join_prev = proc;
+  ctx->joiners = proc;
+  __atomic_fetch_add(&ctx->nr_blocked, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&ctx->thread_lock);
+
+  /* The idle CPUs stop if this was the last process that could run */
+  if (sched_done(ctx))
+    sched_wake_all(ctx);
+}
+
+void thread_exit(struct sim_ctx *ctx, struct pcb_t *proc) {
+  struct pcb_t *parent = proc->parent;
+  if (parent == NULL)
+    return;
+
+  pthread_mutex_lock(&ctx->thread_lock);
+  int wake = --parent->nr_threads == 0 && parent->joining;
+  if (wake) {
+    parent->joining = 0;
+    if (parent->join_prev != NULL)
+      parent->join_prev->join_next = parent->join_next;
+    else
+      ctx->joiners = parent->join_next;
+    if (parent->join_next != NULL)
+      parent->join_next->join_prev = parent->join_prev;
+    parent->join_prev = parent->join_next = NULL;
+    __atomic_fetch_sub(&ctx->nr_blocked, 1, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&ctx->thread_lock);
+
+  if (wake) {
+    parent->stats.blocked +=
+        current_time(&ctx->timer) - parent->stats.blocked_since;
+    fprintf(ctx->out, "\tProcess %2d woken up, its threads are done\n",
+            parent->pid);
+    wake_proc(ctx, parent);
+  }
+}
+
+void thread_destroy(struct sim_ctx *ctx) {
+  struct pcb_t *proc;
+  while ((proc = ctx->joiners) != NULL) {
+    ctx->joiners = proc->join_next;
+    free(proc);
+  }
+}
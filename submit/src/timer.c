@@ -1,136 +1,301 @@
 
 #include "timer.h"
+#include "os-cfg.h"
+#include <limits.h>
+#include <linux/futex.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-static pthread_t _timer;
-
+/* A whole number of cache lines, so devices never share one */
 struct timer_id_container_t {
 	struct timer_id_t id;
 	struct timer_id_container_t * next;
 };
 
-static struct timer_id_container_t * dev_list = NULL;
-
-static uint64_t _time;
-
-static int timer_started = 0;
-static int timer_stop = 0;
-
-
-static void * timer_routine(void * args) {
-	while (!timer_stop) {
-		printf("Time slot %3lu\n", current_time());
-		int fsh = 0;
-		int event = 0;
-		/* Wait for all devices have done the job in current
-		 * time slot */
-		struct timer_id_container_t * temp;
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.event_lock);
-			while (!temp->id.done && !temp->id.fsh) {
-				pthread_cond_wait(
-					&temp->id.event_cond,
-					&temp->id.event_lock
-				);
-			}
-			if (temp->id.fsh) {
-				fsh++;
-			}
-			event++;
-			pthread_mutex_unlock(&temp->id.event_lock);
-		}
-
-		/* Increase the time slot */
-		_time++;
-		
-		/* Let devices continue their job */
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.timer_lock);
-			temp->id.done = 0;
-			pthread_cond_signal(&temp->id.timer_cond);
-			pthread_mutex_unlock(&temp->id.timer_lock);
-		}
-		if (fsh == event) {
+/* Slot barrier
+ *  The low half of barrier_state counts devices that have arrived in the
+ *  current slot, the high half counts attached devices. Keeping both in one
+ *  word lets next_slot and detach_event agree, with a single atomic
+ *  operation, on which device closes the slot. The device that closes it
+ *  advances the time and bumps barrier_gen; everyone else sleeps on
+ *  barrier_gen (futex) until the generation they arrived in is over.
+ */
+#define BARRIER_DEV_ONE		(1ULL << 32)
+#define BARRIER_ARRIVED(s)	((uint32_t)(s))
+#define BARRIER_ATTACHED(s)	((uint32_t)((s) >> 32))
+
+/* Number of polls before a waiting device falls back to futex_wait */
+#define BARRIER_SPIN	64
+
+static void sleep_push(struct timer_struct * timer, struct timer_id_t * id) {
+	if (timer->sleep_size == timer->sleep_cap) {
+		timer->sleep_cap = timer->sleep_cap ? 2 * timer->sleep_cap : 8;
+		timer->sleep_heap = realloc(timer->sleep_heap,
+			timer->sleep_cap * sizeof(struct timer_id_t *));
+	}
+	/* Read without the lock by the devices leaving the barrier */
+	int i = timer->sleep_size;
+	__atomic_store_n(&timer->sleep_size, i + 1, __ATOMIC_RELEASE);
+	while (i > 0 && timer->sleep_heap[(i - 1) / 2]->wake > id->wake) {
+		timer->sleep_heap[i] = timer->sleep_heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	timer->sleep_heap[i] = id;
+}
+
+static struct timer_id_t * sleep_pop(struct timer_struct * timer) {
+	struct timer_id_t * top = timer->sleep_heap[0];
+	int size = timer->sleep_size - 1;
+	__atomic_store_n(&timer->sleep_size, size, __ATOMIC_RELEASE);
+	struct timer_id_t * last = timer->sleep_heap[size];
+	int i = 0;
+	while (2 * i + 1 < timer->sleep_size) {
+		int c = 2 * i + 1;
+		if (c + 1 < timer->sleep_size &&
+				timer->sleep_heap[c + 1]->wake < timer->sleep_heap[c]->wake)
+			c++;
+		if (last->wake <= timer->sleep_heap[c]->wake)
 			break;
-		}
+		timer->sleep_heap[i] = timer->sleep_heap[c];
+		i = c;
 	}
-	pthread_exit(args);
+	timer->sleep_heap[i] = last;
+	return top;
 }
 
-void next_slot(struct timer_id_t * timer_id) {
+static void futex_wait(uint32_t * uaddr, uint32_t val) {
+	syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t * uaddr) {
+	syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Called by the last device of a slot, all others are parked on
+ * barrier_gen so the slot line is printed before any work of the new slot */
+static void close_slot(struct timer_struct * timer, uint64_t state) {
+	__atomic_sub_fetch(&timer->barrier_state, BARRIER_ARRIVED(state),
+		__ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&timer->sleep_lock);
+	uint64_t target = timer->time + 1;
+#ifdef TIMER_FASTFWD
+	/* Nobody did anything in this slot (or nobody is left awake), so
+	 * nothing can happen before the first sleeper wakes up */
+	if (!timer->slot_busy || BARRIER_ATTACHED(state) == 0) {
+		uint64_t wake = timer->slot_hint;
+		if (timer->sleep_size > 0 && timer->sleep_heap[0]->wake < wake)
+			wake = timer->sleep_heap[0]->wake;
+		if (wake != UINT64_MAX && wake > target)
+			target = wake;
+	}
+#endif
+	timer->slot_busy = 0;
+	timer->slot_hint = UINT64_MAX;
+
+	/* Increase the time slot */
+	step_timer(timer, target);
+
+	/* Sleepers that are due rejoin the barrier for the new slot */
+	while (timer->sleep_size > 0 &&
+			timer->sleep_heap[0]->wake <= timer->time) {
+		struct timer_id_t * id = sleep_pop(timer);
+		__atomic_add_fetch(&timer->barrier_state, BARRIER_DEV_ONE,
+			__ATOMIC_RELAXED);
+		__atomic_store_n(&id->asleep, 0, __ATOMIC_RELEASE);
+		futex_wake(&id->asleep);
+	}
+	pthread_mutex_unlock(&timer->sleep_lock);
+
+	/* Let devices continue their job */
+	__atomic_add_fetch(&timer->barrier_gen, 1, __ATOMIC_RELEASE);
+	futex_wake(&timer->barrier_gen);
+}
+
+static void arrive(struct timer_id_t * timer_id) {
+	struct timer_struct * timer = timer_id->timer;
+	uint32_t gen = __atomic_load_n(&timer->barrier_gen, __ATOMIC_ACQUIRE);
+
 	/* Tell to timer that we have done our job in current slot */
-	pthread_mutex_lock(&timer_id->event_lock);
-	timer_id->done = 1;
-	pthread_cond_signal(&timer_id->event_cond);
-	pthread_mutex_unlock(&timer_id->event_lock);
+	uint64_t state = __atomic_add_fetch(&timer->barrier_state, 1,
+		__ATOMIC_ACQ_REL);
+	if (BARRIER_ARRIVED(state) == BARRIER_ATTACHED(state)) {
+		close_slot(timer, state);
+		return;
+	}
 
 	/* Wait for going to next slot */
-	pthread_mutex_lock(&timer_id->timer_lock);
-	while (timer_id->done) {
-		pthread_cond_wait(
-			&timer_id->timer_cond,
-			&timer_id->timer_lock
-		);
+	int spin;
+	for (spin = 0; spin < BARRIER_SPIN; spin++) {
+		if (__atomic_load_n(&timer->barrier_gen, __ATOMIC_ACQUIRE) != gen)
+			return;
+	}
+	while (__atomic_load_n(&timer->barrier_gen, __ATOMIC_ACQUIRE) == gen) {
+		futex_wait(&timer->barrier_gen, gen);
 	}
-	pthread_mutex_unlock(&timer_id->timer_lock);
 }
 
-uint64_t current_time() {
-	return _time;
+/* Only write slot_busy once per slot, the other busy devices just read
+ * the line instead of taking it over */
+static void mark_busy(struct timer_struct * timer) {
+	if (!__atomic_load_n(&timer->slot_busy, __ATOMIC_RELAXED))
+		__atomic_store_n(&timer->slot_busy, 1, __ATOMIC_RELAXED);
 }
 
-void start_timer() {
-	timer_started = 1;
-	pthread_create(&_timer, NULL, timer_routine, NULL);
+void next_slot(struct timer_id_t * timer_id) {
+	struct timer_struct * timer = timer_id->timer;
+	mark_busy(timer);
+	arrive(timer_id);
 }
 
-void detach_event(struct timer_id_t * event) {
-	pthread_mutex_lock(&event->event_lock);
-	event->fsh = 1;
-	pthread_cond_signal(&event->event_cond);
-	pthread_mutex_unlock(&event->event_lock);
-}
-
-struct timer_id_t * attach_event() {
-	if (timer_started) {
-		return NULL;
-	}else{
-		struct timer_id_container_t * container =
-			(struct timer_id_container_t*)malloc(
-				sizeof(struct timer_id_container_t)		
-			);
-		container->id.done = 0;
-		container->id.fsh = 0;
-		pthread_cond_init(&container->id.event_cond, NULL);
-		pthread_mutex_init(&container->id.event_lock, NULL);
-		pthread_cond_init(&container->id.timer_cond, NULL);
-		pthread_mutex_init(&container->id.timer_lock, NULL);
-		if (dev_list == NULL) {
-			dev_list = container;
-			dev_list->next = NULL;
-		}else{
-			container->next = dev_list;
-			dev_list = container;
-		}
-		return &(container->id);
+void idle_slot(struct timer_id_t * timer_id) {
+	arrive(timer_id);
+}
+
+void idle_until(struct timer_id_t * timer_id, uint64_t time) {
+	struct timer_struct * timer = timer_id->timer;
+	uint64_t hint = __atomic_load_n(&timer->slot_hint, __ATOMIC_RELAXED);
+	while (time < hint && !__atomic_compare_exchange_n(&timer->slot_hint,
+			&hint, time, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	arrive(timer_id);
+}
+
+void sleep_until(struct timer_id_t * timer_id, uint64_t time) {
+	struct timer_struct * timer = timer_id->timer;
+#ifdef TIMER_FASTFWD
+	if (current_time(timer) >= time)
+		return;
+
+	timer_id->wake = time;
+	timer_id->asleep = 1;
+	pthread_mutex_lock(&timer->sleep_lock);
+	sleep_push(timer, timer_id);
+	pthread_mutex_unlock(&timer->sleep_lock);
+
+	/* Leave the barrier, the slot may be waiting only for us */
+	uint64_t state = __atomic_sub_fetch(&timer->barrier_state,
+		BARRIER_DEV_ONE, __ATOMIC_ACQ_REL);
+	if (BARRIER_ARRIVED(state) == BARRIER_ATTACHED(state))
+		close_slot(timer, state);
+
+	while (__atomic_load_n(&timer_id->asleep, __ATOMIC_ACQUIRE)) {
+		futex_wait(&timer_id->asleep, 1);
 	}
+#else
+	while (current_time(timer) < time) {
+		idle_slot(timer_id);
+	}
+#endif
 }
 
-void stop_timer() {
-	timer_stop = 1;
-	pthread_join(_timer, NULL);
-	while (dev_list != NULL) {
-		struct timer_id_container_t * temp = dev_list;
-		dev_list = dev_list->next;
-		pthread_cond_destroy(&temp->id.event_cond);
-		pthread_mutex_destroy(&temp->id.event_lock);
-		pthread_cond_destroy(&temp->id.timer_cond);
-		pthread_mutex_destroy(&temp->id.timer_lock);
-		free(temp);
+void busy_until(struct timer_id_t * timer_id, uint64_t time) {
+	mark_busy(timer_id->timer);
+	sleep_until(timer_id, time);
+}
+
+void park_prepare(struct timer_id_t * timer_id) {
+	__atomic_store_n(&timer_id->asleep, 1, __ATOMIC_RELAXED);
+}
+
+void park_event(struct timer_id_t * timer_id) {
+	struct timer_struct * timer = timer_id->timer;
+	/* Leave the barrier, the slot may be waiting only for us. If we have
+	 * been unparked already, the count is back up and nothing closes. */
+	uint64_t state = __atomic_sub_fetch(&timer->barrier_state,
+		BARRIER_DEV_ONE, __ATOMIC_ACQ_REL);
+	if (BARRIER_ARRIVED(state) == BARRIER_ATTACHED(state) &&
+			(BARRIER_ATTACHED(state) != 0 ||
+			 __atomic_load_n(&timer->sleep_size, __ATOMIC_ACQUIRE) != 0))
+		close_slot(timer, state);
+
+	while (__atomic_load_n(&timer_id->asleep, __ATOMIC_ACQUIRE)) {
+		futex_wait(&timer_id->asleep, 1);
+	}
+}
+
+void unpark_event(struct timer_id_t * timer_id) {
+	struct timer_struct * timer = timer_id->timer;
+	__atomic_add_fetch(&timer->barrier_state, BARRIER_DEV_ONE,
+		__ATOMIC_ACQ_REL);
+	__atomic_store_n(&timer_id->asleep, 0, __ATOMIC_RELEASE);
+	futex_wake(&timer_id->asleep);
+}
+
+void step_timer(struct timer_struct * timer, uint64_t time) {
+	while (timer->time < time) {
+		timer->time++;
+		fprintf(timer->out, "Time slot %3lu\n", current_time(timer));
 	}
 }
 
+uint64_t current_time(struct timer_struct * timer) {
+	return timer->time;
+}
 
+void init_timer(struct timer_struct * timer, FILE * out) {
+	timer->dev_list = NULL;
+	timer->time = 0;
+	timer->started = 0;
+	timer->barrier_state = 0;
+	timer->barrier_gen = 0;
+	timer->slot_busy = 0;
+	timer->slot_hint = UINT64_MAX;
+	pthread_mutex_init(&timer->sleep_lock, NULL);
+	timer->sleep_heap = NULL;
+	timer->sleep_size = 0;
+	timer->sleep_cap = 0;
+	timer->out = out;
+}
 
+void start_timer(struct timer_struct * timer) {
+	timer->started = 1;
+	fprintf(timer->out, "Time slot %3lu\n", current_time(timer));
+}
 
+void detach_event(struct timer_id_t * event) {
+	struct timer_struct * timer = event->timer;
+	event->fsh = 1;
+	mark_busy(timer);
+	uint64_t state = __atomic_sub_fetch(&timer->barrier_state,
+		BARRIER_DEV_ONE, __ATOMIC_ACQ_REL);
+	/* The remaining devices may all be waiting for us, or all be asleep */
+	if (BARRIER_ARRIVED(state) == BARRIER_ATTACHED(state) &&
+			(BARRIER_ATTACHED(state) != 0 ||
+			 __atomic_load_n(&timer->sleep_size, __ATOMIC_ACQUIRE) != 0)) {
+		close_slot(timer, state);
+	}
+}
+
+/* Once the timer has started, the caller must be a device that has not
+ * arrived in the current slot yet: the slot cannot close under us, and the
+ * new device takes part in it. */
+struct timer_id_t * attach_event(struct timer_struct * timer) {
+	struct timer_id_container_t * container =
+		(struct timer_id_container_t*)aligned_alloc(CACHE_LINE_SIZE,
+			sizeof(struct timer_id_container_t)
+		);
+	container->id.timer = timer;
+	container->id.fsh = 0;
+	container->id.asleep = 0;
+	container->id.wake = 0;
+	container->next = __atomic_load_n(&timer->dev_list, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&timer->dev_list, &container->next,
+			container, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	__atomic_add_fetch(&timer->barrier_state, BARRIER_DEV_ONE,
+		__ATOMIC_ACQ_REL);
+	return &(container->id);
+}
+
+void stop_timer(struct timer_struct * timer) {
+	while (timer->dev_list != NULL) {
+		struct timer_id_container_t * temp = timer->dev_list;
+		timer->dev_list = timer->dev_list->next;
+		free(temp);
+	}
+	free(timer->sleep_heap);
+	pthread_mutex_destroy(&timer->sleep_lock);
+}